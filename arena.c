@@ -0,0 +1,298 @@
+/**
+ * @file   arena.c
+ * @author Rakesh Iyer
+ * @brief  An implementation of a region allocator. Blocks come from a variable pool,
+ *         a fixed pool or malloc, and objects are carved from them with a bump pointer.
+ *         Releasing memory only moves the pointer back and hands back whole blocks, so
+ *         it costs the same no matter how many objects were allocated.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+static int constructArena(lpx_arena_t *arena, long blockSize, lpx_mempool_variable_t *pool,
+                          lpx_mempool_fixed_t *fixedPool);
+static int addBlock(lpx_arena_t *arena, long size);
+static void releaseBlock(lpx_arena_t *arena, lpx_arena_block_t *block);
+
+/**
+ * @brief  Create an arena that gets its blocks from malloc.
+ * @param  arena The arena to initialize.
+ * @param  blockSize The size of the blocks to allocate.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_init(lpx_arena_t *arena, long blockSize)
+{
+    if (arena == NULL) {
+        return ARENA_ERROR;
+    }
+
+    return constructArena(arena, blockSize, NULL, NULL);
+}
+
+/**
+ * @brief  Create an arena that gets its blocks from a variable pool.
+ * @param  arena The arena to initialize.
+ * @param  blockSize The size of the blocks to allocate.
+ * @param  pool The pool to allocate blocks from.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_init_from_pool(lpx_arena_t *arena, long blockSize,
+                             lpx_mempool_variable_t *pool)
+{
+    if (arena == NULL || pool == NULL) {
+        return ARENA_ERROR;
+    }
+
+    return constructArena(arena, blockSize, pool, NULL);
+}
+
+/**
+ * @brief  Create an arena that uses the objects of a fixed pool as its blocks. No
+ *         single allocation can be larger than an object of the pool. Aligned fixed
+ *         pools work too.
+ * @param  arena The arena to initialize.
+ * @param  pool The pool to allocate blocks from.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_init_from_fixed_pool(lpx_arena_t *arena, lpx_mempool_fixed_t *pool)
+{
+    if (arena == NULL || pool == NULL) {
+        return ARENA_ERROR;
+    }
+
+    return constructArena(arena, pool->storedObjectSize - pool->headerSize, NULL, pool);
+}
+
+/**
+ * @brief  Set up an arena and get its first block.
+ * @param  arena The arena to initialize.
+ * @param  blockSize The size of the blocks.
+ * @param  pool A variable pool to get blocks from, or NULL.
+ * @param  fixedPool A fixed pool to get blocks from, or NULL.
+ * @return 0 on success, -1 on failure.
+ */
+static int constructArena(lpx_arena_t *arena, long blockSize, lpx_mempool_variable_t *pool,
+                          lpx_mempool_fixed_t *fixedPool)
+{
+    if (blockSize <= (long)sizeof(lpx_arena_block_t)) {
+        return ARENA_ERROR;
+    }
+
+    arena->pool = pool;
+    arena->fixedPool = fixedPool;
+    arena->blockSize = blockSize;
+    arena->current = NULL;
+    arena->next = NULL;
+    arena->end = NULL;
+
+    if (0 != addBlock(arena, 0)) {
+        return ARENA_ERROR;
+    }
+
+    arena->magic = ARENA_MAGIC;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Allocate an object from the arena. It lives until the arena is reset or
+ *         released to a mark taken before it.
+ * @param  arena The arena to allocate from.
+ * @param  size The size of the object.
+ * @return The object on success, NULL on failure.
+ */
+void *lpx_arena_alloc(lpx_arena_t *arena, long size)
+{
+    char *addr = NULL;
+
+    if (UNLIKELY(arena == NULL || arena->magic != ARENA_MAGIC || size < 0)) {
+        return NULL;
+    }
+
+    // Keep the objects aligned like the pools do.
+    size = (size + sizeof(long) - 1) & ~(long)(sizeof(long) - 1);
+    if (UNLIKELY(arena->end - arena->next < size)) {
+        if (0 != addBlock(arena, size)) {
+            return NULL;
+        }
+    }
+
+    addr = arena->next;
+    arena->next += size;
+    return addr;
+}
+
+/**
+ * @brief  Remember the current position of the arena.
+ * @param  arena The arena.
+ * @param  mark Receives the position.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_mark(lpx_arena_t *arena, lpx_arena_mark_t *mark)
+{
+    if (arena == NULL || arena->magic != ARENA_MAGIC || mark == NULL) {
+        return ARENA_ERROR;
+    }
+
+    mark->block = arena->current;
+    mark->next = arena->next;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Release every object allocated since the mark was taken. The blocks that
+ *         were added since are given back. Marks taken after this one are no longer
+ *         valid afterwards.
+ * @param  arena The arena.
+ * @param  mark A mark taken on this arena.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_release_to_mark(lpx_arena_t *arena, lpx_arena_mark_t *mark)
+{
+    lpx_arena_block_t *block = NULL;
+
+    if (arena == NULL || arena->magic != ARENA_MAGIC || mark == NULL || mark->block == NULL) {
+        return ARENA_ERROR;
+    }
+
+    // A stale or foreign mark must not cost us any blocks, so find it before freeing.
+    block = arena->current;
+    while (block != NULL && block != mark->block) {
+        block = block->prev;
+    }
+    if (block == NULL || mark->next < (char *)(block + 1) || mark->next > block->end ||
+        (block == arena->current && mark->next > arena->next)) {
+        return ARENA_ERROR;
+    }
+
+    while (arena->current != mark->block) {
+        block = arena->current;
+        arena->current = block->prev;
+        releaseBlock(arena, block);
+    }
+
+    arena->next = mark->next;
+    arena->end = arena->current->end;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Release every object of the arena. The first block is kept for reuse,
+ *         all the others are given back.
+ * @param  arena The arena to reset.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_reset(lpx_arena_t *arena)
+{
+    lpx_arena_block_t *block = NULL;
+
+    if (arena == NULL || arena->magic != ARENA_MAGIC) {
+        return ARENA_ERROR;
+    }
+
+    while (arena->current->prev != NULL) {
+        block = arena->current;
+        arena->current = block->prev;
+        releaseBlock(arena, block);
+    }
+
+    arena->next = (char *)(arena->current + 1);
+    arena->end = arena->current->end;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Release all the blocks of the arena.
+ * @param  arena The arena to destroy.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_arena_destroy(lpx_arena_t *arena)
+{
+    lpx_arena_block_t *block = NULL;
+
+    if (arena == NULL || arena->magic != ARENA_MAGIC) {
+        return ARENA_ERROR;
+    }
+
+    while (arena->current != NULL) {
+        block = arena->current;
+        arena->current = block->prev;
+        releaseBlock(arena, block);
+    }
+
+    arena->next = NULL;
+    arena->end = NULL;
+    arena->magic = 0;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Get a new block and make it the current one. Requests that do not fit a
+ *         regular block get a block of their own, unless blocks come from a fixed pool.
+ * @param  arena The arena.
+ * @param  size The size of the object the block is needed for.
+ * @return 0 on success, -1 on failure.
+ */
+static int addBlock(lpx_arena_t *arena, long size)
+{
+    lpx_arena_block_t *block = NULL;
+    long blockSize = arena->blockSize;
+
+    if (size > blockSize - (long)sizeof(lpx_arena_block_t)) {
+        if (arena->fixedPool != NULL) {
+            return ARENA_ERROR;
+        }
+        blockSize = size + sizeof(lpx_arena_block_t);
+    }
+
+    if (arena->fixedPool != NULL) {
+        block = (lpx_arena_block_t *)lpx_mempool_fixed_alloc(arena->fixedPool);
+    } else if (arena->pool != NULL) {
+        block = (lpx_arena_block_t *)lpx_mempool_variable_alloc(arena->pool, blockSize);
+    } else {
+        block = (lpx_arena_block_t *)malloc(blockSize);
+    }
+    if (block == NULL) {
+        return ARENA_ERROR;
+    }
+
+    block->prev = arena->current;
+    block->end = (char *)block + blockSize;
+    arena->current = block;
+    arena->next = (char *)(block + 1);
+    arena->end = block->end;
+    return ARENA_SUCCESS;
+}
+
+/**
+ * @brief  Give a block back to where it came from.
+ * @param  arena The arena the block belongs to.
+ * @param  block The block.
+ */
+static void releaseBlock(lpx_arena_t *arena, lpx_arena_block_t *block)
+{
+    if (arena->fixedPool != NULL) {
+        // Objects of aligned pools have no header pointing back at their pool.
+        if (arena->fixedPool->headerSize == 0) {
+            lpx_mempool_aligned_free(block);
+        } else {
+            lpx_mempool_fixed_free(block);
+        }
+    } else if (arena->pool != NULL) {
+        lpx_mempool_variable_free(block);
+    } else {
+        free(block);
+    }
+}
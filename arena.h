@@ -0,0 +1,86 @@
+/**
+ * @file   arena.h
+ * @brief  A region allocator for memory with a common lifetime, such as everything
+ *         allocated while serving one request.
+ * @author Rakesh Iyer.
+ * @bug    Not thread safe, an arena belongs to one thread at a time.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "mempool.h"
+
+/**
+ * @def   ARENA_SUCCESS
+ * @brief Represents a success.
+ */
+#define ARENA_SUCCESS		0
+
+/**
+ * @def   ARENA_ERROR
+ * @brief Represents a failure.
+ */
+#define ARENA_ERROR		-1
+
+/**
+ * @def   ARENA_MAGIC
+ * @brief Magic number to check the integrity of an arena.
+ */
+#define ARENA_MAGIC		0xa4e4a000
+
+/**
+ * @brief The header of a block of an arena. Objects are carved from the memory
+ *        right after it.
+ */
+typedef struct __arena_block_t {
+    struct __arena_block_t *prev;	/**< The block that was in use before this one. */
+    char *end;				/**< The end of the block. */
+}lpx_arena_block_t;
+
+/**
+ * @brief An arena. Objects are allocated by bumping a pointer through the current
+ *        block and are never freed one by one, only all at once by a reset or all
+ *        that came after a mark.
+ */
+typedef struct __arena_t {
+    lpx_mempool_variable_t *pool;	/**< Where blocks come from, NULL if not a variable pool. */
+    lpx_mempool_fixed_t *fixedPool;	/**< Where blocks come from, NULL if not a fixed pool. */
+    long blockSize;			/**< The size of a block, header included. */
+    lpx_arena_block_t *current;		/**< The block being carved, the newest one. */
+    char *next;				/**< The next free byte in the current block. */
+    char *end;				/**< The end of the current block. */
+    unsigned int magic;			/**< Enables a simple integrity check. */
+}lpx_arena_t;
+
+/**
+ * @brief A position in an arena to go back to.
+ */
+typedef struct __arena_mark_t {
+    lpx_arena_block_t *block;		/**< The block that was current. */
+    char *next;				/**< The next free byte in it. */
+}lpx_arena_mark_t;
+
+int lpx_arena_init(lpx_arena_t *arena, long blockSize);
+int lpx_arena_init_from_pool(lpx_arena_t *arena, long blockSize,
+                             lpx_mempool_variable_t *pool);
+int lpx_arena_init_from_fixed_pool(lpx_arena_t *arena, lpx_mempool_fixed_t *pool);
+void *lpx_arena_alloc(lpx_arena_t *arena, long size);
+int lpx_arena_mark(lpx_arena_t *arena, lpx_arena_mark_t *mark);
+int lpx_arena_release_to_mark(lpx_arena_t *arena, lpx_arena_mark_t *mark);
+int lpx_arena_reset(lpx_arena_t *arena);
+int lpx_arena_destroy(lpx_arena_t *arena);
+#endif
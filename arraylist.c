@@ -22,17 +22,33 @@
 
 /**
  * @def ALLOC
- * @brief A wrapper around the pool alloc and regular malloc.
+ * @brief A wrapper around the pool allocs and regular malloc.
  */
-#define ALLOC(pool,size) (((pool) == NULL)? malloc((size)) : lpx_mempool_variable_alloc((pool), (size)))
+#define ALLOC(list,size) (((list)->sizedPool != NULL) ? \
+                          lpx_mempool_sized_alloc((list)->sizedPool, (size)) : \
+                          ((list)->pool == NULL) ? malloc((size)) : \
+                          lpx_mempool_variable_alloc((list)->pool, (size)))
 
 /**
  * @def FREE
- * @brief A wrapper around the pool free or regular free.
+ * @brief A wrapper around the pool frees or regular free.
  */
-#define FREE(pool,ptr) (((pool) == NULL) ? free((ptr)) : lpx_mempool_variable_free((ptr)))
+#define FREE(list,ptr) (((list)->sizedPool != NULL) ? \
+                        (void)lpx_mempool_sized_free((list)->sizedPool, (ptr)) : \
+                        ((list)->pool == NULL) ? free((ptr)) : \
+                        (void)lpx_mempool_variable_free((ptr)))
 
-static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempool_variable_t *pool);
+/**
+ * @def REALLOC
+ * @brief A wrapper around the pool reallocs or regular realloc.
+ */
+#define REALLOC(list,ptr,size) (((list)->sizedPool != NULL) ? \
+                                lpx_mempool_sized_realloc((list)->sizedPool, (ptr), (size)) : \
+                                ((list)->pool == NULL) ? realloc((ptr), (size)) : \
+                                lpx_mempool_variable_realloc((list)->pool, (ptr), (size)))
+
+static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempool_variable_t *pool,
+                              lpx_mempool_sized_t *sizedPool);
 static int growList(lpx_arraylist_t *list);
 static inline long *getElementAtIndex(lpx_arraylist_t *list, long index);
 
@@ -49,7 +65,7 @@ int lpx_arraylist_init(lpx_arraylist_t *list, int isProtected)
         return ARRAYLIST_ERROR;
     }
 
-    return constructArraylist(list, isProtected, NULL);
+    return constructArraylist(list, isProtected, NULL, NULL);
 }
 
 /**
@@ -66,7 +82,25 @@ int lpx_arraylist_init_from_pool(lpx_arraylist_t *list, int isProtected, lpx_mem
         return ARRAYLIST_ERROR;
     }
 
-    return constructArraylist(list, isProtected, pool);
+    return constructArraylist(list, isProtected, pool, NULL);
+}
+
+/**
+ * @brief  Create an arraylist that allocates from a sized pool.
+ * @param  list The list to initialize.
+ * @param  isProtected ARRAYLIST_PROTECTED if it should be protected by a mutex,
+ *                     ARRAYLIST_UNPROTECTED if not.
+ * @param  pool The sized pool to use for allocations and deallocations.
+ * @return 0 on success, -1 on error.
+ */
+int lpx_arraylist_init_from_sized_pool(lpx_arraylist_t *list, int isProtected, 
+                                       lpx_mempool_sized_t *pool)
+{
+    if (list == NULL || pool == NULL) {
+        return ARRAYLIST_ERROR;
+    }
+
+    return constructArraylist(list, isProtected, NULL, pool);
 }
 
 /**
@@ -74,18 +108,21 @@ int lpx_arraylist_init_from_pool(lpx_arraylist_t *list, int isProtected, lpx_mem
  * @param  list Pointer to the list that has to be created.
  * @param  isProtected Use an rwlock to protect the list or not?
  * @param  pool The memory pool to use, if any.
+ * @param  sizedPool The sized pool to use, if any.
  * @return 0 on success, -1 on error.
  */
-static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempool_variable_t *pool)
+static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempool_variable_t *pool,
+                              lpx_mempool_sized_t *sizedPool)
 {
     int i = 0;
 
     list->pool = pool;
+    list->sizedPool = sizedPool;
 
     // Initialize any protection mechanisms requested.
     if (isProtected == ARRAYLIST_PROTECTED) {
         // Allocate space for the rwlock.
-        list->rwlock = ALLOC(list->pool, sizeof(lpx_rwlock_t));
+        list->rwlock = ALLOC(list, sizeof(lpx_rwlock_t));
 	if (list->rwlock == NULL) {
 	    return ARRAYLIST_ERROR;
 	}
@@ -99,7 +136,7 @@ static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempoo
     // Allocate the number of heads.
     list->size = 0;
     list->numHeads = ARRAYLIST_DEFAULT_NUMHEADS;
-    list->heads = ALLOC(list->pool, ARRAYLIST_DEFAULT_NUMHEADS * sizeof(long *));
+    list->heads = ALLOC(list, ARRAYLIST_DEFAULT_NUMHEADS * sizeof(long *));
     if (list->heads == NULL) {
         goto construct_error2;
     }
@@ -110,16 +147,16 @@ static int constructArraylist(lpx_arraylist_t *list, int isProtected, lpx_mempoo
     }
 
     // Now allocate space in the first head.
-    list->heads[0] = ALLOC(list->pool, sizeof(long) * ARRAYLIST_HEAD_SIZE);
+    list->heads[0] = ALLOC(list, sizeof(long) * ARRAYLIST_HEAD_SIZE);
     if (list->heads[0] == NULL) {
         goto construct_error3;
     }
     
     return ARRAYLIST_SUCCESS;
 
-construct_error3: FREE(list->pool, list->heads);
+construct_error3: FREE(list, list->heads);
 construct_error2: lpx_rwlock_destroy(list->rwlock);
-construct_error1: FREE(list->pool, list->rwlock);
+construct_error1: FREE(list, list->rwlock);
     return ARRAYLIST_ERROR;
 
 }
@@ -140,17 +177,17 @@ int lpx_arraylist_destroy(lpx_arraylist_t *list)
     // Destroy each of the parts of the arraylist.
     for (i = 0; i < list->numHeads; i++) {
         if (NULL != list->heads[i]) {
-	    FREE(list->pool, list->heads[i]);
+	    FREE(list, list->heads[i]);
 	}
     }
 
     // Destroy the array of heads.
-    FREE(list->pool, list->heads);
+    FREE(list, list->heads);
 
     // Destroy the reader writer lock.
     if (list->rwlock != NULL) {
         lpx_rwlock_destroy(list->rwlock);
-	FREE(list->pool, list->rwlock);
+	FREE(list, list->rwlock);
     }
 
     return ARRAYLIST_SUCCESS;
@@ -266,7 +303,7 @@ int lpx_arraylist_append(lpx_arraylist_t *list, long value)
 	// See if we need to add a head.
 	newIndex = list->size / ARRAYLIST_HEAD_SIZE;
 	if (list->heads[newIndex] == NULL) {
-	    list->heads[newIndex] = ALLOC(list->pool, sizeof(long) * ARRAYLIST_HEAD_SIZE);
+	    list->heads[newIndex] = ALLOC(list, sizeof(long) * ARRAYLIST_HEAD_SIZE);
 	    if (list->heads[newIndex] == NULL) {
 	        return ARRAYLIST_ERROR;
 	    }
@@ -297,15 +334,14 @@ static int growList(lpx_arraylist_t *list)
     long **newHeads = NULL;
 
     // Grow the list of heads if we have run out of slots in the array of heads.
+    // Pools grow it in place when they can.
     if (list->heads[list->numHeads - 1] != NULL) {
-        newHeads = ALLOC(list->pool, (sizeof(long *) * list->numHeads * 2));
+        newHeads = REALLOC(list, list->heads, (sizeof(long *) * list->numHeads * 2));
 	if (newHeads == NULL) {
 	    return ARRAYLIST_ERROR;
 	}
 
-	memset(newHeads, 0, sizeof(long *) * list->numHeads * 2);
-	memcpy(newHeads, list->heads, sizeof(long *) * list->numHeads);
-	FREE(list->pool, list->heads);
+	memset(newHeads + list->numHeads, 0, sizeof(long *) * list->numHeads);
 	list->heads = newHeads;
 	list->numHeads *= 2;
     }
@@ -379,7 +415,7 @@ int lpx_arraylist_clear(lpx_arraylist_t *list)
     // of heads because it is expensive to grow the list of heads.
     for (i = 1; i < list->numHeads; i++) {
         if (NULL != list->heads[i]) {
-	    FREE(list->pool, list->heads[i]);
+	    FREE(list, list->heads[i]);
 	    list->heads[i] = NULL;
 	}
     }
@@ -417,7 +453,7 @@ long *lpx_arraylist_to_array(lpx_arraylist_t *list)
         return NULL;
     }
 
-    array = ALLOC(list->pool, list->size * sizeof(long));
+    array = ALLOC(list, list->size * sizeof(long));
     if (array != NULL) {
         for (i = 0; i < list->size; i += ARRAYLIST_HEAD_SIZE) {
 	    // Determine how many bytes are remaining in the copy.
@@ -39,6 +39,7 @@
 
 typedef struct __lpx_arraylist_t {
     lpx_mempool_variable_t *pool;
+    lpx_mempool_sized_t *sizedPool;
     lpx_rwlock_t *rwlock;
     long size;
     int numHeads;
@@ -48,6 +49,8 @@ typedef struct __lpx_arraylist_t {
 int lpx_arraylist_init(lpx_arraylist_t *list, int isProtected);
 int lpx_arraylist_init_from_pool(lpx_arraylist_t *list, int isProtected,
                                  lpx_mempool_variable_t *pool);
+int lpx_arraylist_init_from_sized_pool(lpx_arraylist_t *list, int isProtected,
+                                       lpx_mempool_sized_t *pool);
 int lpx_arraylist_destroy(lpx_arraylist_t *list);
 int lpx_arraylist_get(lpx_arraylist_t *list, long index, long *value);
 int lpx_arraylist_set(lpx_arraylist_t *list, long index, long value);
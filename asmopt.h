@@ -33,6 +33,13 @@
 #define PREFETCHNTA(x) do { } while (0)
 #endif
 
+/* Tell the CPU that this is a spin loop, it saves power and the pipeline flush on exit. */
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_PAUSE() asm volatile ("pause" ::: "memory")
+#else
+#define CPU_PAUSE() asm volatile ("" ::: "memory")
+#endif
+
 #ifdef USE_PREDICTOR_HINTS
 #define LIKELY(x)    __builtin_expect((x), 1)
 #define UNLIKELY(x)  __builtin_expect((x), 0)
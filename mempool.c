@@ -19,16 +19,114 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include "mempool.h"
 
+/**
+ * @def   MEMPOOL_OWNS_BLOCK
+ * @brief Internal flag that marks a pool whose memory was allocated by the library
+ *        and therefore has to be released when the pool is destroyed.
+ */
+#define MEMPOOL_OWNS_BLOCK		0x40000000
+
+/**
+ * @def   MEMPOOL_PINNED
+ * @brief Internal flag that marks a pool as pinned so that slabs added later get pinned too.
+ */
+#define MEMPOOL_PINNED			0x20000000
+
+/**
+ * @def   MEMPOOL_MAPPED
+ * @brief Internal flag that marks a pool whose block was mapped with mmap rather than malloced.
+ */
+#define MEMPOOL_MAPPED			0x10000000
+
+/**
+ * @def   MEMPOOL_NUMA_RECHECK
+ * @brief How many NUMA pool allocations a thread makes before it asks again which node it
+ *        is running on.
+ */
+#define MEMPOOL_NUMA_RECHECK		64
+
+/**
+ * @def   ALIGN_UP
+ * @brief Round a size up to a multiple of a power of two.
+ */
+#define ALIGN_UP(size, alignment)	(((size) + (alignment) - 1) & ~((long)(alignment) - 1))
+
+/**
+ * @def   COUNT_STAT
+ * @brief Add to a counter in the calling thread's slot of a stats block, if there is one.
+ */
+#define COUNT_STAT(stats, counter, n)	do {						\
+					    if ((stats) != NULL) {			\
+					        __sync_fetch_and_add(&statSlot(stats)->counter, (n)); \
+					    }						\
+					} while (0)
+
 // Forward declarations of functions for internal consumption of the library.
-static void *findFirstFit(lpx_mempool_variable_t *, long);
-static void *splitBlock(lpx_mempool_variable_t *, void *, long *);
-static void insertIntoFreeList(lpx_mempool_variable_t *, void *);
-static void insertAfter(long *, long *);
-static void insertBefore(long *, long *);
-static void coalesceBlocks(long *, long *, long *);
-static void coalesce(long *, long *);
+static long mappedSize(long, int);
+static void *mapPoolMemory(long, int);
+static int numNumaNodes(void);
+static int lockSharedPool(lpx_mempool_shared_header_t *);
+static int currentNode(int);
+static lpx_mempool_stats_block_t *createStats(void);
+static inline int sizeClass(long);
+static long sizeClassSize(int);
+static inline lpx_mempool_stats_slot_t *statSlot(lpx_mempool_stats_block_t *);
+static void sumStats(lpx_mempool_stats_block_t *, lpx_mempool_stats_t *);
+static inline void raiseHighWater(lpx_mempool_stats_block_t *, long);
+static inline int lockPool(pthread_mutex_t *, lpx_mempool_stats_block_t *);
+static lpx_mempool_fixed_cache_t *getThreadCache(lpx_mempool_fixed_t *);
+static void releaseThreadCache(void *);
+static void unlinkThreadCache(lpx_mempool_fixed_t *, lpx_mempool_fixed_cache_t *);
+static long *cachePop(lpx_mempool_fixed_cache_t *);
+static void cachePush(lpx_mempool_fixed_cache_t *, long *);
+static long *refillThreadCache(lpx_mempool_fixed_t *, lpx_mempool_fixed_cache_t *);
+static int flushThreadCache(lpx_mempool_fixed_t *, lpx_mempool_fixed_cache_t *);
+static void stealThreadCaches(lpx_mempool_fixed_t *);
+static int spliceIntoFreeList(lpx_mempool_fixed_t *, long *);
+static int initFixedPool(lpx_mempool_fixed_t *, int);
+static inline void *prepObject(lpx_mempool_fixed_t *, long *);
+static int freeObject(lpx_mempool_fixed_t *, long *);
+static long *threadObjects(void *, long, int);
+static long *carveObjects(lpx_mempool_fixed_t *, int, int *);
+static int growFixedPool(lpx_mempool_fixed_t *, int);
+static void trimFixedPool(lpx_mempool_fixed_t *);
+static lpx_mempool_fixed_slab_t *findSlab(lpx_mempool_fixed_slab_t **, int, long *);
+static int compareSlabs(const void *, const void *);
+static int freeChain(lpx_mempool_fixed_t *, long *, long *, int);
+static long *lockFreePop(lpx_mempool_fixed_t *);
+static int lockFreePopChain(lpx_mempool_fixed_t *, void **, int);
+static void lockFreePush(lpx_mempool_fixed_t *, long *, long *);
+static int casTaggedHead(lpx_mempool_tagged_head_t *, lpx_mempool_tagged_head_t,
+                         lpx_mempool_tagged_head_t);
+static long *findFit(lpx_mempool_variable_t *, long);
+static void *splitBlock(lpx_mempool_variable_t *, long *, long *);
+static void freeBlock(lpx_mempool_variable_t *, long *);
+static void indexInsert(lpx_mempool_variable_t *, long *);
+static void indexRemove(lpx_mempool_variable_t *, long *);
+static long *binFind(lpx_mempool_variable_t *, long);
+static inline int binIndex(long);
+static void binInsert(lpx_mempool_variable_t *, long *);
+static void binRemove(lpx_mempool_variable_t *, long *);
+static void visitFreeLists(lpx_mempool_variable_t *, void (*)(long *, void *), void *);
+static void countFreeBlocks(long *, void *);
+static void initRegion(lpx_mempool_variable_t *, long *, long);
+static int growVariablePool(lpx_mempool_variable_t *, long);
+static void purgeFreeBlocks(long *, void *);
+static inline lpx_mempool_variable_t *threadArena(lpx_mempool_variable_t *);
+static inline int isArenaOf(lpx_mempool_variable_t *, lpx_mempool_variable_t *);
+static long *tlsfFind(lpx_mempool_tlsf_t *, long);
+static inline void tlsfMapping(long, int *, int *);
+static void tlsfInsert(lpx_mempool_tlsf_t *, long *);
+static void tlsfRemove(lpx_mempool_tlsf_t *, long *);
+static inline void tagFreeBlock(long *, long);
 
 /**
  * @brief  Create a memory pool that can allocate fixed sized objects.
@@ -38,6 +136,11 @@ static void coalesce(long *, long *);
  * @param  isProtected Whether to protect the pool with a mutex or not. Only allocations
  *                     on protected pools are thread safe. Use an unprotected pool only
  *                     when you know that you will not be sharing a pool between threads.
+ *                     MEMPOOL_LOCKFREE pools are thread safe without using a mutex.
+ *                     MEMPOOL_PROTECTED may be or'ed with MEMPOOL_THREAD_CACHE.
+ *                     Any mode may be or'ed with MEMPOOL_HUGEPAGES and MEMPOOL_POPULATE
+ *                     to map the pool instead of mallocing it, and with MEMPOOL_LAZY_INIT
+ *                     to skip initializing the objects up front.
  * @return 0 on success, -1 on failure.
  */
 int lpx_mempool_create_fixed_pool(lpx_mempool_fixed_t *pool, 
@@ -51,26 +154,46 @@ int lpx_mempool_create_fixed_pool(lpx_mempool_fixed_t *pool,
 
     // Get all the memory needed up front.
     unsigned long baseSize  = (objectSize + MEMPOOL_PER_OBJECT_OVERHEAD) * numObjects;
-    void *base = malloc(baseSize);
+    void *base = NULL;
+    if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+        base = mapPoolMemory(baseSize, isProtected);
+    } else {
+        base = malloc(baseSize);
+    }
     if (base == NULL) {
         return MEMPOOL_FAILURE;
     }
 
-    return lpx_mempool_create_fixed_pool_from_block(pool, objectSize, numObjects, baseSize, isProtected, base);
+    if (0 != lpx_mempool_create_fixed_pool_from_block(pool, objectSize, numObjects, baseSize, isProtected, base)) {
+        if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+            munmap(base, mappedSize(baseSize, isProtected));
+        } else {
+            free(base);
+        }
+        return MEMPOOL_FAILURE;
+    }
+
+    // The block came from us, so destroying the pool should release it too.
+    pool->flags |= MEMPOOL_OWNS_BLOCK;
+    if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+        pool->flags |= MEMPOOL_MAPPED;
+    }
+    return MEMPOOL_SUCCESS;
 }
 
 /**
  * @brief  Create a memory pool that can allocate fixed sized objects inside an
  *         existing block of memory. Note that you need to destroy pools created in this way
  *         by destroying the block of memory (*base) itself, ie if it was obtained from another pool 
- *         call, you should deallocate that block. If you call mempool destroy on this, it will 
- *         most likely cause a segfault. If base was created using malloc, then just call free on base
+ *         call, you should deallocate that block. Calling mempool destroy on this releases the
+ *         mutex and any thread caches of the pool but leaves the block alone, so do that first
+ *         if the pool is protected. If base was created using malloc, then just call free on base
  *         and your pool is gone. See the tests for an example of how to use these pools.
  * @param  pool       The pool to create.
  * @param  objectSize The size of each object in the pool.
  * @param  numObjects Number of objects desired in the pool.
  * @param  size       Size of the block provided.
- * @param  isProtected Should the pool be protected by a mutex.
+ * @param  isProtected Should the pool be protected by a mutex. See lpx_mempool_create_fixed_pool.
  * @param  base       The block of memory. Should be atleast (objectSize + MEMPOOL_PER_OBJECT_OVERHEAD) * numObjects.
  * @return 0 on success -1 on failure.
  */
@@ -81,672 +204,3652 @@ int lpx_mempool_create_fixed_pool_from_block(lpx_mempool_fixed_t *pool,
                                              int isProtected,
 					     void *base)
 {
-    long *currentBlockHeader = NULL;
-    long storedObjectSize = 0;
-    int i = 0;
-
     if (UNLIKELY(pool == NULL || base == NULL || objectSize <= 0 ||
         numObjects <= 0 || size < objectSize + MEMPOOL_PER_OBJECT_OVERHEAD)) {
         return MEMPOOL_FAILURE;
     }
 
-    // A null in place of the mutex means that the caller didn't need thread safety.
-    if (isProtected == MEMPOOL_PROTECTED) {
-        pool->poolMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-        if (pool->poolMutex == NULL) {
-            return MEMPOOL_FAILURE;
-        }
+    // Sanitize the size of the block of memory provided.
+    if (size < (objectSize + MEMPOOL_PER_OBJECT_OVERHEAD) * numObjects) {
+        return MEMPOOL_FAILURE;
+    }
 
-        if (0 != pthread_mutex_init(pool->poolMutex, NULL)) {
-	    goto cfbpool_destroy1;
-	}
-    } else {
-        pool->poolMutex = NULL;
+    if (0 != initFixedPool(pool, isProtected)) {
+        return MEMPOOL_FAILURE;
     }
 
-    // Sanitize the size of the block of memory provided and give it to the pool for initialization.
+    // Give the block to the pool for initialization.
     pool->storedObjectSize = objectSize + MEMPOOL_PER_OBJECT_OVERHEAD;
     pool->poolSize = pool->storedObjectSize * numObjects;
-
-    if (size < pool->poolSize) {
-        goto cfbpool_destroy2;
-    } 
     pool->pool = base;
+    pool->freeCount = numObjects;
+    pool->numObjects = numObjects;
 
-    // Initialize the memory pool. Pay the cost of initializing the data structure
-    // upfront so that allocations become deterministic time.
-    storedObjectSize = pool->storedObjectSize;
-    currentBlockHeader = (long *)pool->pool;
-    for (i = 0; i < numObjects - 1; i++) {
-	// The header points to the next free block.
-        *currentBlockHeader = (long)currentBlockHeader + storedObjectSize;
-	currentBlockHeader = (long *)*currentBlockHeader;
+    // Lazy pools hand out the block from a bump pointer and only recycle through the free list.
+    if (isProtected & MEMPOOL_LAZY_INIT) {
+        pool->bumpNext = (char *)pool->pool;
+        pool->bumpEnd = (char *)pool->pool + pool->poolSize;
+    } else {
+        // Initialize the memory pool. Pay the cost of initializing the data structure
+        // upfront so that allocations become deterministic time.
+        threadObjects(pool->pool, pool->storedObjectSize, numObjects);
+        pool->freeList = pool->pool;
+        pool->lockFreeList.head = pool->pool;
     }
-    
-    // Now null terminate the list and plug it into the free list.
-    *currentBlockHeader = 0;
-    pool->freeList = pool->pool;
 
     // Finally, endorse this struct as a valid memory pool.
     pool->magic = MEMPOOL_FIXED_MAGIC;
 
     return MEMPOOL_SUCCESS;
-
-cfbpool_destroy2: if (pool->poolMutex != NULL) { pthread_mutex_destroy(pool->poolMutex); }
-cfbpool_destroy1: free(pool->poolMutex);
-    return MEMPOOL_FAILURE;
 }
 
 /**
- * @brief  Pin the memory that backs the pool in RAM.
- * @param  pool The pool to pin in memory.
+ * @brief  Create a memory pool of fixed sized objects that have no header and start at
+ *         a given alignment, so a 64 byte object aligned to 64 bytes takes exactly one
+ *         cache line. The objects live in slabs of MEMPOOL_ALIGNED_SLAB_SIZE bytes that
+ *         are aligned to their size, and the pool is found from the slab header by
+ *         masking the address of an object. Objects from these pools have to be freed
+ *         with lpx_mempool_aligned_free, and cannot be freed in bulk.
+ * @param  pool        The pool to create.
+ * @param  objectSize  Size of an individual object in the pool.
+ * @param  alignment   Alignment of the objects, a power of two no smaller than a pointer.
+ * @param  numObjects  The number of objects in the pool.
+ * @param  isProtected See lpx_mempool_create_fixed_pool.
  * @return 0 on success, -1 on failure.
  */
-int lpx_mempool_pin_fixed_pool(lpx_mempool_fixed_t *pool)
+int lpx_mempool_create_aligned_fixed_pool(lpx_mempool_fixed_t *pool,
+                                          long objectSize,
+                                          long alignment,
+                                          int numObjects,
+                                          int isProtected)
 {
-    if (UNLIKELY(pool == NULL)) {
+    long storedObjectSize = 0;
+    int remaining = numObjects;
+
+    if (UNLIKELY(pool == NULL || objectSize <= 0 || numObjects <= 0 ||
+        alignment < (long)sizeof(void *) || (alignment & (alignment - 1)) != 0)) {
         return MEMPOOL_FAILURE;
     }
 
-    return mlock(pool->pool, pool->poolSize);
-}
+    // Free objects hold the link to the next one in their first word.
+    storedObjectSize = objectSize < (long)sizeof(void *) ? (long)sizeof(void *) : objectSize;
+    storedObjectSize = (storedObjectSize + alignment - 1) & ~(alignment - 1);
+    if (ALIGN_UP(sizeof(lpx_mempool_fixed_slab_t), alignment) + storedObjectSize > 
+        MEMPOOL_ALIGNED_SLAB_SIZE) {
+        return MEMPOOL_FAILURE;
+    }
 
-/**
- * @brief  Unpin the memory that backs the pool from RAM.
- * @param  pool The pool to unpin.
- * @return 0 on success, -1 on failure.
- */
-int lpx_mempool_unpin_fixed_pool(lpx_mempool_fixed_t *pool)
-{
-    if (UNLIKELY(pool == NULL)) {
+    if (0 != initFixedPool(pool, isProtected)) {
         return MEMPOOL_FAILURE;
     }
 
-    return munlock(pool->pool, pool->poolSize);
+    pool->storedObjectSize = storedObjectSize;
+    pool->headerSize = 0;
+    pool->alignment = alignment;
+    pool->slabSize = MEMPOOL_ALIGNED_SLAB_SIZE;
+    pool->magic = MEMPOOL_FIXED_MAGIC;
+
+    // All the memory lives in slabs, get enough of them up front.
+    while (remaining > 0) {
+        if (0 != growFixedPool(pool, remaining)) {
+            lpx_mempool_destroy_fixed_pool(pool);
+            return MEMPOOL_FAILURE;
+        }
+        remaining -= pool->slabs->numObjects;
+    }
+
+    return MEMPOOL_SUCCESS;
 }
 
 /**
- * @brief  Allocate an object from a fixed sized pool.
- * @param  pool The pool to allocate from.
- * @return A valid address on success, NULL on failure.
+ * @brief  Set up the parts of a fixed pool that do not depend on where its memory
+ *         comes from. The pool starts out empty and does not grow.
+ * @param  pool The pool to initialize.
+ * @param  isProtected The protection mode or'ed with the creation flags.
+ * @return 0 on success, -1 on failure.
  */
-void *lpx_mempool_fixed_alloc(lpx_mempool_fixed_t *pool)
+static int initFixedPool(lpx_mempool_fixed_t *pool, int isProtected)
 {
-    void *addr = NULL;
-    long *object = NULL;
-    
-    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_FIXED_MAGIC)) {
-        return NULL;
-    }
+    int protection = isProtected & MEMPOOL_PROTECTION_MASK;
+    int flags = isProtected & ~MEMPOOL_PROTECTION_MASK;
 
-    // Lock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_lock(pool->poolMutex)) {
-	    return NULL;
-	}
+    // Thread caches trade objects with the shared free list under the pool mutex.
+    if ((flags & MEMPOOL_THREAD_CACHE) && protection != MEMPOOL_PROTECTED) {
+        return MEMPOOL_FAILURE;
     }
 
-    // Grab the first object from the free list.
-    object = (long *)pool->freeList;
-    if (object == NULL) {
-        if (pool->poolMutex != NULL) {
-	    pthread_mutex_unlock(pool->poolMutex);
-	}
-	return NULL;
-    }
+    // A null in place of the mutex means that the caller didn't need thread safety.
+    if (protection == MEMPOOL_PROTECTED) {
+        pool->poolMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+        if (pool->poolMutex == NULL) {
+            return MEMPOOL_FAILURE;
+        }
 
-    // Ok, got an onject to return, update the free list to point to the next object.
-    pool->freeList = (void *)(*object);
+        if (0 != pthread_mutex_init(pool->poolMutex, NULL)) {
+            free(pool->poolMutex);
+            return MEMPOOL_FAILURE;
+        }
+    } else {
+        pool->poolMutex = NULL;
+    }
 
-    // Prep the object for return to the caller.
-    *object = (long)pool;
-    addr = (void *)((long)object + MEMPOOL_PER_OBJECT_OVERHEAD);
+    pool->stats = NULL;
+    if (flags & MEMPOOL_STATS) {
+        pool->stats = createStats();
+        if (pool->stats == NULL) {
+            if (pool->poolMutex != NULL) {
+                pthread_mutex_destroy(pool->poolMutex);
+                free(pool->poolMutex);
+            }
+            return MEMPOOL_FAILURE;
+        }
+    }
 
-    // Unlock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
-	    return NULL;
-	}
+    // Each thread finds its own cache through a key, released when the thread exits.
+    // Running out of keys only costs us the caches, the pool works fine without them.
+    pool->flags = isProtected;
+    pool->caches = NULL;
+    if (flags & MEMPOOL_THREAD_CACHE) {
+        if (0 != pthread_key_create(&pool->cacheKey, releaseThreadCache)) {
+            pool->flags &= ~MEMPOOL_THREAD_CACHE;
+        }
     }
 
-    return addr;
+    pool->pool = NULL;
+    pool->poolSize = 0;
+    pool->headerSize = MEMPOOL_PER_OBJECT_OVERHEAD;
+    pool->alignment = sizeof(long);
+    pool->slabSize = 0;
+    pool->freeList = NULL;
+    pool->lockFreeList.head = NULL;
+    pool->lockFreeList.tag = 0;
+    pool->bumpNext = NULL;
+    pool->bumpEnd = NULL;
+    pool->freeCount = 0;
+
+    // The pool does not grow unless asked to.
+    pool->slabs = NULL;
+    pool->slabObjects = 0;
+    pool->numObjects = 0;
+    pool->lowWaterMark = -1;
+    pool->trimThreshold = 0;
+
+    return MEMPOOL_SUCCESS;
 }
 
 /**
- * @brief  Free an object that was allocated on a fixed mem pool.
- * @param  addr The address of the object that needs to be freed.
+ * @brief  Pin the memory that backs the pool in RAM.
+ * @param  pool The pool to pin in memory.
  * @return 0 on success, -1 on failure.
  */
-int lpx_mempool_fixed_free(void *addr)
+int lpx_mempool_pin_fixed_pool(lpx_mempool_fixed_t *pool)
 {
-    long *object = (long *)((long)addr - MEMPOOL_PER_OBJECT_OVERHEAD);
-    lpx_mempool_fixed_t *pool = NULL;
-
-    if (UNLIKELY(addr == NULL)) {
-        return MEMPOOL_FAILURE;
-    }
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    int retval = 0;
 
-    // The first sizeof(long) bytes from the actual start are a back
-    // pointer to the pool that this address belongs to.
-    pool = (lpx_mempool_fixed_t *)*object;
-    if (pool->magic != MEMPOOL_FIXED_MAGIC) {
+    if (UNLIKELY(pool == NULL)) {
         return MEMPOOL_FAILURE;
     }
 
-    // Lock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_lock(pool->poolMutex)) {
-	    return MEMPOOL_FAILURE;
-	}
-    }
-
-    // Re-link the object into the free list.
-    *object = (long)pool->freeList;
-    pool->freeList = object;
-
-    // Unlock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
-	    return MEMPOOL_FAILURE;
-	}
+    // Slabs that the pool grows later on are pinned as they are added.
+    pool->flags |= MEMPOOL_PINNED;
+    retval = mlock(pool->pool, pool->flags & MEMPOOL_MAPPED ?
+                   mappedSize(pool->poolSize, pool->flags) : pool->poolSize);
+    for (slab = pool->slabs; slab != NULL && retval == 0; slab = slab->next) {
+        retval = mlock(slab, slab->size);
     }
 
-    return MEMPOOL_SUCCESS;
+    return retval;
 }
 
 /**
- * @brief  Destroy all the resources associated with a fixed sized pool.
- * @param  pool The pool to destroy.
+ * @brief  Unpin the memory that backs the pool from RAM.
+ * @param  pool The pool to unpin.
  * @return 0 on success, -1 on failure.
  */
-int lpx_mempool_destroy_fixed_pool(lpx_mempool_fixed_t *pool)
+int lpx_mempool_unpin_fixed_pool(lpx_mempool_fixed_t *pool)
 {
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    int retval = 0;
+
     if (UNLIKELY(pool == NULL)) {
         return MEMPOOL_FAILURE;
     }
 
-    pool->magic = 0;
-
-    /* Be safe and unlock the address range. */
-    lpx_mempool_unpin_fixed_pool(pool);
-
-    if (pool->poolMutex != NULL) {
-        pthread_mutex_destroy(pool->poolMutex);
-        free(pool->poolMutex);
+    pool->flags &= ~MEMPOOL_PINNED;
+    retval = munlock(pool->pool, pool->flags & MEMPOOL_MAPPED ?
+                     mappedSize(pool->poolSize, pool->flags) : pool->poolSize);
+    for (slab = pool->slabs; slab != NULL && retval == 0; slab = slab->next) {
+        retval = munlock(slab, slab->size);
     }
 
-    free(pool->pool);
-
-    return MEMPOOL_SUCCESS;
+    return retval;
 }
 
-
 /**
- * @brief  Create a memory pool that can allocate variable sized objects inside an
- *         existing block of memory.
- * @param  pool The pool to allocate create.
- * @param  size The total size of the block provided.
- * @param  isProtected Should the pool be protected by a mutex?
- * @param  base The block of memory for the pool to be created in.
+ * @brief  Create a fixed pool with a sub-pool on every NUMA node. Allocations are served
+ *         from the node the calling thread runs on and objects go back to the sub-pool they
+ *         came from when they are freed with lpx_mempool_fixed_free.
+ * @param  pool              The pool to create.
+ * @param  objectSize        Size of an individual object in the pool.
+ * @param  numObjectsPerNode The number of objects in each sub-pool.
+ * @param  isProtected       The protection mode and flags of the sub-pools. See
+ *                           lpx_mempool_create_fixed_pool.
  * @return 0 on success, -1 on failure.
  */
-int lpx_mempool_create_variable_pool_from_block(lpx_mempool_variable_t *pool, 
-                                                long size, 
-						int isProtected, 
-						void *base)
+int lpx_mempool_create_numa_pool(lpx_mempool_numa_t *pool,
+                                 long objectSize,
+                                 int numObjectsPerNode,
+                                 int isProtected)
 {
-    long *blockMetadata = NULL;
+    unsigned long nodeMask = 0;
+    long baseSize = 0;
+    void *base = NULL;
+    int node = 0;
 
-    if (UNLIKELY(pool == NULL || base == NULL)) {
+    if (UNLIKELY(pool == NULL || objectSize <= 0 || numObjectsPerNode <= 0)) {
         return MEMPOOL_FAILURE;
     }
 
-    if (size <= MEMPOOL_PER_BLOCK_OVERHEAD) {
+    pool->numNodes = numNumaNodes();
+    pool->nodePools = (lpx_mempool_fixed_t *)calloc(pool->numNodes, sizeof(lpx_mempool_fixed_t));
+    if (pool->nodePools == NULL) {
         return MEMPOOL_FAILURE;
     }
 
-    if (isProtected == MEMPOOL_PROTECTED) {
-        pool->poolMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-	if (pool->poolMutex == NULL) {
-	    return MEMPOOL_FAILURE;
-	}
-     
-        if (0 != pthread_mutex_init(pool->poolMutex, NULL)) {
-	    free(pool->poolMutex);
-	    return MEMPOOL_FAILURE;
-	}
-    } else {
-        pool->poolMutex = NULL;
-    }
-
-    // Allocate all the memory up front.
-    // size -= MEMPOOL_PER_BLOCK_OVERHEAD;
-    pool->pool = base;
-    pool->poolSize = size;
-    pool->freeList = pool->pool;
+    // MAP_POPULATE would place the pages before they are bound, leave it to first touch.
+    isProtected &= ~MEMPOOL_POPULATE;
+    baseSize = (objectSize + MEMPOOL_PER_OBJECT_OVERHEAD) * numObjectsPerNode;
+    for (node = 0; node < pool->numNodes; node++) {
+        base = mapPoolMemory(baseSize, isProtected);
+        if (base == NULL) {
+            goto cleanup;
+        }
 
-    // Set up the block metadata.
-    blockMetadata = (long *)pool->freeList;
-    blockMetadata[VPMD_SIZE_OFFSET] = pool->poolSize;
-    blockMetadata[VPMD_PREV_OFFSET] = 0; // NULL the prev pointer.
-    blockMetadata[VPMD_NEXT_OFFSET] = 0; // NULL the next pointer.
-    
-    // Finally, set the flag to indicate that this pool is valid.
-    pool->magic = MEMPOOL_VARIABLE_MAGIC;
+        // The policy decides where pages go no matter who touches them first. It is only
+        // a preference, so a node that is out of memory or a failed call costs locality
+        // and nothing else.
+        nodeMask = 1UL << node;
+        syscall(SYS_mbind, base, mappedSize(baseSize, isProtected), MPOL_PREFERRED, 
+                &nodeMask, MEMPOOL_NUMA_MAX_NODES + 1, 0);
+
+        if (0 != lpx_mempool_create_fixed_pool_from_block(&pool->nodePools[node], objectSize, 
+                                                          numObjectsPerNode, baseSize, 
+                                                          isProtected, base)) {
+            munmap(base, mappedSize(baseSize, isProtected));
+            goto cleanup;
+        }
+        pool->nodePools[node].flags |= MEMPOOL_OWNS_BLOCK | MEMPOOL_MAPPED;
+    }
 
+    pool->magic = MEMPOOL_NUMA_MAGIC;
     return MEMPOOL_SUCCESS;
-}
-
 
+cleanup:
+    while (--node >= 0) {
+        lpx_mempool_destroy_fixed_pool(&pool->nodePools[node]);
+    }
+    free(pool->nodePools);
+    pool->nodePools = NULL;
+    return MEMPOOL_FAILURE;
+}
 
 /**
- * @brief  Create a memory pool that can allocate variable sized objects.
+ * @brief  Allocate an object from the sub-pool of the node that the caller is running on.
+ *         When that sub-pool is exhausted the other nodes are tried in turn.
  * @param  pool The pool to allocate from.
- * @param  size The total size of the memory pool.
- * @param  isProtected Should the pool be protected by a mutex?
- * @return 0 on success, -1 on failure.
+ * @return A valid address on success, NULL on failure.
  */
-int lpx_mempool_create_variable_pool(lpx_mempool_variable_t *pool, 
-                                     long size, int isProtected)
+void *lpx_mempool_numa_alloc(lpx_mempool_numa_t *pool)
 {
-    if (UNLIKELY(pool == NULL)) {
-        return MEMPOOL_FAILURE;
+    void *object = NULL;
+    int home = 0;
+    int node = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_NUMA_MAGIC)) {
+        return NULL;
     }
 
-    // Allocate all the memory up front.
-    size += MEMPOOL_PER_BLOCK_OVERHEAD;
-    void *base  = malloc(size);
-    if (base == NULL) {
-        free(pool->poolMutex);
-	return MEMPOOL_FAILURE;
+    home = currentNode(pool->numNodes);
+    object = lpx_mempool_fixed_alloc(&pool->nodePools[home]);
+    for (node = (home + 1) % pool->numNodes; UNLIKELY(object == NULL) && node != home; 
+         node = (node + 1) % pool->numNodes) {
+        object = lpx_mempool_fixed_alloc(&pool->nodePools[node]);
     }
 
-    return lpx_mempool_create_variable_pool_from_block(pool, size, isProtected, base);
+    return object;
 }
 
 /**
- * @brief  Pin the memory that is backing the pool in RAM.
- * @param  The memory pool to pin.
+ * @brief  Destroy a NUMA pool and all of its sub-pools.
+ * @param  pool The pool to destroy.
  * @return 0 on success, -1 on failure.
  */
-int lpx_mempool_pin_variable_pool(lpx_mempool_variable_t *pool)
+int lpx_mempool_destroy_numa_pool(lpx_mempool_numa_t *pool)
 {
-    if (UNLIKELY(pool == NULL)) {
+    int node = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_NUMA_MAGIC)) {
         return MEMPOOL_FAILURE;
     }
 
-    return mlock(pool->pool, pool->poolSize);
+    for (node = 0; node < pool->numNodes; node++) {
+        lpx_mempool_destroy_fixed_pool(&pool->nodePools[node]);
+    }
+    free(pool->nodePools);
+    pool->nodePools = NULL;
+    pool->magic = 0;
+
+    return MEMPOOL_SUCCESS;
 }
 
 /**
- * @brief  Unpin the memory that is backing the pool from RAM.
- * @param  The memory pool to unpin.
- * @return 0 on success, -1 on failure.
+ * @brief  Find out how many NUMA nodes the machine has.
+ * @return The highest online node plus one, 1 if that cannot be found out.
  */
-int lpx_mempool_unpin_variable_pool(lpx_mempool_variable_t *pool)
+static int numNumaNodes(void)
 {
-    if (UNLIKELY(pool == NULL)) {
-        return MEMPOOL_FAILURE;
+    char nodes[256];
+    char *highest = nodes;
+    char *next = NULL;
+    int numNodes = 1;
+    FILE *online = fopen("/sys/devices/system/node/online", "r");
+
+    if (online == NULL) {
+        return 1;
+    }
+
+    // The list reads like "0", "0-3" or "0,2-3" and ends with the highest node.
+    if (fgets(nodes, sizeof(nodes), online) != NULL) {
+        for (next = nodes; *next != '\0'; next++) {
+            if (*next == '-' || *next == ',') {
+                highest = next + 1;
+            }
+        }
+        numNodes = atoi(highest) + 1;
     }
+    fclose(online);
 
-    return munlock(pool->pool, pool->poolSize);
+    if (numNodes < 1) {
+        return 1;
+    }
+
+    return numNodes > MEMPOOL_NUMA_MAX_NODES ? MEMPOOL_NUMA_MAX_NODES : numNodes;
 }
 
 /**
- * @brief  Allocate a variable sized object on the memory pool.
- * @param  pool The pool to allocate from.
- * @param  size The size of the object to allocate.
- * @return A valid address on success, NULL on failure.
+ * @brief  Find the node that the calling thread is running on. The answer is cached per
+ *         thread for MEMPOOL_NUMA_RECHECK calls to keep getcpu off the allocation path.
+ * @param  numNodes The number of nodes of the pool asking.
+ * @return The node, 0 if it is not known or beyond numNodes.
  */
-void *lpx_mempool_variable_alloc(lpx_mempool_variable_t *pool, long size)
+static int currentNode(int numNodes)
 {
-    void *candidateBlock = NULL;
+    static __thread int node = -1;
+    static __thread int uses = 0;
+    unsigned int cpu = 0;
+    unsigned int newNode = 0;
+
+    if (UNLIKELY(node < 0 || ++uses >= MEMPOOL_NUMA_RECHECK)) {
+        uses = 0;
+        if (0 != syscall(SYS_getcpu, &cpu, &newNode, NULL)) {
+            newNode = 0;
+        }
+        node = newNode;
+    }
+
+    return node < numNodes ? node : 0;
+}
+
+/**
+ * @brief  Work out the size of the block that a shared pool needs.
+ * @param  objectSize Size of an individual object in the pool.
+ * @param  numObjects The number of objects in the pool.
+ * @return The size of the block.
+ */
+long lpx_mempool_shared_pool_size(long objectSize, int numObjects)
+{
+    return ALIGN_UP(sizeof(lpx_mempool_shared_header_t), 64) + 
+           (ALIGN_UP(objectSize, sizeof(long)) + MEMPOOL_PER_OBJECT_OVERHEAD) * numObjects;
+}
+
+/**
+ * @brief  Create a fixed pool in a new POSIX shared memory object that other processes
+ *         can open by name with lpx_mempool_open_shared_pool.
+ * @param  pool       The handle of the pool to create.
+ * @param  name       The name of the shared memory object, see shm_open. It must not exist yet.
+ * @param  objectSize Size of an individual object in the pool.
+ * @param  numObjects The number of objects in the pool.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_shared_pool(lpx_mempool_shared_t *pool,
+                                   const char *name,
+                                   long objectSize,
+                                   int numObjects)
+{
+    void *base = MAP_FAILED;
+    long size = 0;
+    int fd = -1;
+
+    if (UNLIKELY(pool == NULL || name == NULL || strlen(name) >= MEMPOOL_SHARED_NAME_SIZE ||
+        objectSize <= 0 || numObjects <= 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    size = lpx_mempool_shared_pool_size(objectSize, numObjects);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (0 != ftruncate(fd, size)) {
+        goto cleanup;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        goto cleanup;
+    }
+
+    if (0 != lpx_mempool_create_shared_pool_from_block(pool, objectSize, numObjects, size, base)) {
+        munmap(base, size);
+        goto cleanup;
+    }
+
+    close(fd);
+    pool->mappedSize = size;
+    strcpy(pool->name, name);
+    return MEMPOOL_SUCCESS;
+
+cleanup:
+    close(fd);
+    shm_unlink(name);
+    return MEMPOOL_FAILURE;
+}
+
+/**
+ * @brief  Create a fixed pool inside a block of memory that is shared between processes,
+ *         for instance a MAP_SHARED mapping inherited across fork. Other processes get at
+ *         the pool with lpx_mempool_attach_shared_pool. The pool is always lazily
+ *         initialized, so creating it touches nothing but the first page.
+ * @param  pool       The handle of the pool to create.
+ * @param  objectSize Size of an individual object in the pool.
+ * @param  numObjects The number of objects in the pool.
+ * @param  size       Size of the block provided.
+ * @param  base       The block of memory. Should be at least lpx_mempool_shared_pool_size.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_shared_pool_from_block(lpx_mempool_shared_t *pool,
+                                              long objectSize,
+                                              int numObjects,
+                                              long size,
+                                              void *base)
+{
+    lpx_mempool_shared_header_t *header = (lpx_mempool_shared_header_t *)base;
+    pthread_mutexattr_t attr;
+
+    if (UNLIKELY(pool == NULL || base == NULL || objectSize <= 0 || numObjects <= 0 ||
+        ((long)base & (sizeof(long) - 1)) != 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (size < lpx_mempool_shared_pool_size(objectSize, numObjects)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // A process that dies holding the mutex must not take the others down with it.
+    if (0 != pthread_mutexattr_init(&attr)) {
+        return MEMPOOL_FAILURE;
+    }
+    if (0 != pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) ||
+        0 != pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) ||
+        0 != pthread_mutex_init(&header->mutex, &attr)) {
+        pthread_mutexattr_destroy(&attr);
+        return MEMPOOL_FAILURE;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    header->storedObjectSize = ALIGN_UP(objectSize, sizeof(long)) + MEMPOOL_PER_OBJECT_OVERHEAD;
+    header->numObjects = numObjects;
+    header->size = size;
+    header->freeList = 0;
+    header->bumpNext = ALIGN_UP(sizeof(lpx_mempool_shared_header_t), 64);
+    header->bumpEnd = header->bumpNext + header->storedObjectSize * numObjects;
+    header->freeCount = numObjects;
+
+    // Processes attaching to the block go by the magic, so it has to come last.
+    __sync_synchronize();
+    header->magic = MEMPOOL_SHARED_MAGIC;
+
+    pool->header = header;
+    pool->mappedSize = 0;
+    pool->name[0] = '\0';
+    pool->magic = MEMPOOL_SHARED_MAGIC;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Open a shared pool that another process created with lpx_mempool_create_shared_pool.
+ * @param  pool The handle to open the pool with.
+ * @param  name The name of the shared memory object.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_open_shared_pool(lpx_mempool_shared_t *pool, const char *name)
+{
+    struct stat info;
+    void *base = NULL;
+    int fd = -1;
+
+    if (UNLIKELY(pool == NULL || name == NULL || strlen(name) >= MEMPOOL_SHARED_NAME_SIZE)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (0 != fstat(fd, &info) || info.st_size < (long)sizeof(lpx_mempool_shared_header_t)) {
+        close(fd);
+        return MEMPOOL_FAILURE;
+    }
+
+    base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (0 != lpx_mempool_attach_shared_pool(pool, base)) {
+        munmap(base, info.st_size);
+        return MEMPOOL_FAILURE;
+    }
+
+    pool->mappedSize = info.st_size;
+    strcpy(pool->name, name);
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Get a handle on a shared pool that was created in a block this process has
+ *         mapped, at whatever address.
+ * @param  pool The handle to attach.
+ * @param  base The start of the block.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_attach_shared_pool(lpx_mempool_shared_t *pool, void *base)
+{
+    lpx_mempool_shared_header_t *header = (lpx_mempool_shared_header_t *)base;
+
+    if (UNLIKELY(pool == NULL || base == NULL || header->magic != MEMPOOL_SHARED_MAGIC)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    pool->header = header;
+    pool->mappedSize = 0;
+    pool->name[0] = '\0';
+    pool->magic = MEMPOOL_SHARED_MAGIC;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Allocate an object from a shared pool.
+ * @param  pool The pool to allocate from.
+ * @return A valid address in this process on success, NULL on failure.
+ */
+void *lpx_mempool_shared_alloc(lpx_mempool_shared_t *pool)
+{
+    lpx_mempool_shared_header_t *header = NULL;
+    long offset = 0;
+    long *object = NULL;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC)) {
+        return NULL;
+    }
+
+    header = pool->header;
+    if (0 != lockSharedPool(header)) {
+        return NULL;
+    }
+
+    // Recycled objects first, then the never used ones.
+    offset = header->freeList;
+    if (offset != 0) {
+        header->freeList = *(long *)((char *)header + offset);
+    } else if (header->bumpNext < header->bumpEnd) {
+        offset = header->bumpNext;
+        header->bumpNext += header->storedObjectSize;
+    }
+    if (offset != 0) {
+        header->freeCount--;
+    }
+
+    pthread_mutex_unlock(&header->mutex);
+    if (offset == 0) {
+        return NULL;
+    }
+
+    object = (long *)((char *)header + offset);
+    *object = offset;
+    return (void *)((char *)object + MEMPOOL_PER_OBJECT_OVERHEAD);
+}
+
+/**
+ * @brief  Free an object of a shared pool. Any process that has the pool open may free
+ *         it, not just the one that allocated it.
+ * @param  pool The pool that the object belongs to.
+ * @param  addr The address of the object in this process.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_shared_free(lpx_mempool_shared_t *pool, void *addr)
+{
+    lpx_mempool_shared_header_t *header = NULL;
+    long *object = (long *)((char *)addr - MEMPOOL_PER_OBJECT_OVERHEAD);
+    long offset = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC || addr == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Allocated objects hold their own offset, so strays and double frees show up here.
+    header = pool->header;
+    offset = (char *)object - (char *)header;
+    if (offset <= 0 || offset >= header->bumpEnd || *object != offset) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (0 != lockSharedPool(header)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    *object = header->freeList;
+    header->freeList = offset;
+    header->freeCount++;
+
+    if (0 != pthread_mutex_unlock(&header->mutex)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Turn the address of an object into an offset that means the same to every
+ *         process that has the pool open.
+ * @param  pool The pool the object belongs to.
+ * @param  addr The address of the object in this process.
+ * @return The offset on success, -1 on failure.
+ */
+long lpx_mempool_shared_offset(lpx_mempool_shared_t *pool, void *addr)
+{
+    long offset = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    offset = (char *)addr - (char *)pool->header;
+    if (offset <= 0 || offset >= pool->header->bumpEnd) {
+        return MEMPOOL_FAILURE;
+    }
+
+    return offset;
+}
+
+/**
+ * @brief  Turn an offset from lpx_mempool_shared_offset back into an address in this process.
+ * @param  pool The pool the object belongs to.
+ * @param  offset The offset of the object.
+ * @return The address on success, NULL on failure.
+ */
+void *lpx_mempool_shared_address(lpx_mempool_shared_t *pool, long offset)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC)) {
+        return NULL;
+    }
+
+    if (offset <= 0 || offset >= pool->header->bumpEnd) {
+        return NULL;
+    }
+
+    return (void *)((char *)pool->header + offset);
+}
+
+/**
+ * @brief  Let go of a shared pool in this process. The pool stays usable by the others.
+ * @param  pool The pool to close.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_close_shared_pool(lpx_mempool_shared_t *pool)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (pool->mappedSize != 0) {
+        munmap(pool->header, pool->mappedSize);
+    }
+    pool->header = NULL;
+    pool->magic = 0;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Destroy a shared pool for every process, removing its name if it has one.
+ *         Processes that still have it open keep their mapping but must not use it.
+ * @param  pool The pool to destroy.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_destroy_shared_pool(lpx_mempool_shared_t *pool)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SHARED_MAGIC)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    pool->header->magic = 0;
+    pthread_mutex_destroy(&pool->header->mutex);
+    if (pool->name[0] != '\0') {
+        shm_unlink(pool->name);
+    }
+
+    return lpx_mempool_close_shared_pool(pool);
+}
+
+/**
+ * @brief  Lock the mutex of a shared pool.
+ * @param  header The state of the pool.
+ * @return 0 on success, an error number on failure.
+ */
+static int lockSharedPool(lpx_mempool_shared_header_t *header)
+{
+    int retval = pthread_mutex_lock(&header->mutex);
+
+    // The owner died with the mutex held. It was at most a store or two away from being
+    // done, which can only leak the object it was working on, so carry on.
+    if (UNLIKELY(retval == EOWNERDEAD)) {
+        retval = pthread_mutex_consistent(&header->mutex);
+    }
+
+    return retval;
+}
+
+/**
+ * @brief  Let a fixed pool grow instead of failing allocations once it is exhausted.
+ *         Every time the pool runs out it adds a slab of slabObjects objects. Slabs
+ *         whose objects are all free are released again as long as that leaves at least
+ *         lowWaterMark free objects in the pool. The memory the pool was created with
+ *         is never released. Lock free pools cannot release slabs.
+ * @param  pool        The pool to configure.
+ * @param  slabObjects Objects in each slab added to the pool, 0 to stop growing.
+ * @param  lowWaterMark Free objects to keep around, -1 to never release slabs.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_set_fixed_pool_growth(lpx_mempool_fixed_t *pool, int slabObjects,
+                                      long lowWaterMark)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_FIXED_MAGIC || slabObjects < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // A lock free pop may still read the header of an object in a released slab.
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE && lowWaterMark >= 0) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    pool->slabObjects = slabObjects;
+    pool->lowWaterMark = lowWaterMark < 0 ? -1 : lowWaterMark;
+    pool->trimThreshold = pool->lowWaterMark + slabObjects;
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Allocate an object from a fixed sized pool.
+ * @param  pool The pool to allocate from.
+ * @return A valid address on success, NULL on failure.
+ */
+void *lpx_mempool_fixed_alloc(lpx_mempool_fixed_t *pool)
+{
+    void *addr = NULL;
+    long *object = NULL;
+    int carved = 0;
+    lpx_mempool_fixed_cache_t *cache = NULL;
+    
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_FIXED_MAGIC)) {
+        return NULL;
+    }
+
+    // Try the thread cache first, it only goes to the pool once it runs dry.
+    if (pool->flags & MEMPOOL_THREAD_CACHE) {
+        cache = getThreadCache(pool);
+        if (LIKELY(cache != NULL)) {
+            object = cachePop(cache);
+            if (UNLIKELY(object == NULL)) {
+                object = refillThreadCache(pool, cache);
+                if (object == NULL) {
+                    COUNT_STAT(pool->stats, failedAllocs, 1);
+                    return NULL;
+                }
+            }
+
+            COUNT_STAT(pool->stats, allocs, 1);
+            return prepObject(pool, object);
+        }
+    }
+
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE) {
+        while ((object = lockFreePop(pool)) == NULL) {
+            if ((object = carveObjects(pool, 1, &carved)) != NULL) {
+                break;
+            }
+            if (pool->stats != NULL) {
+                raiseHighWater(pool->stats, pool->numObjects);
+            }
+            if (pool->slabObjects == 0 || 0 != growFixedPool(pool, pool->slabObjects)) {
+                COUNT_STAT(pool->stats, failedAllocs, 1);
+                return NULL;
+            }
+        }
+
+        COUNT_STAT(pool->stats, allocs, 1);
+        return prepObject(pool, object);
+    }
+
+    // Lock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+	    return NULL;
+	}
+    }
+
+    // Grab the first object from the free list, carving or growing the pool if we may.
+    if (pool->freeList == NULL) {
+        pool->freeList = carveObjects(pool, 1, &carved);
+    }
+    if (pool->freeList == NULL && pool->slabObjects != 0) {
+        growFixedPool(pool, pool->slabObjects);
+    }
+    object = (long *)pool->freeList;
+    if (object == NULL) {
+        if (pool->poolMutex != NULL) {
+	    pthread_mutex_unlock(pool->poolMutex);
+	}
+        COUNT_STAT(pool->stats, failedAllocs, 1);
+	return NULL;
+    }
+
+    // Ok, got an onject to return, update the free list to point to the next object.
+    pool->freeList = (void *)(*object);
+    pool->freeCount--;
+    if (pool->stats != NULL) {
+        COUNT_STAT(pool->stats, allocs, 1);
+        raiseHighWater(pool->stats, pool->numObjects - pool->freeCount);
+    }
+
+    // Prep the object for return to the caller.
+    addr = prepObject(pool, object);
+
+    // Unlock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+	    return NULL;
+	}
+    }
+
+    return addr;
+}
+
+/**
+ * @brief  Free an object that was allocated on a fixed mem pool.
+ * @param  addr The address of the object that needs to be freed.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_fixed_free(void *addr)
+{
+    long *object = (long *)((long)addr - MEMPOOL_PER_OBJECT_OVERHEAD);
+    lpx_mempool_fixed_t *pool = NULL;
+
+    if (UNLIKELY(addr == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // The first sizeof(long) bytes from the actual start are a back
+    // pointer to the pool that this address belongs to.
+    pool = (lpx_mempool_fixed_t *)*object;
+    if (pool->magic != MEMPOOL_FIXED_MAGIC) {
+        return MEMPOOL_FAILURE;
+    }
+
+    return freeObject(pool, object);
+}
+
+/**
+ * @brief  Free an object that was allocated on a pool created with 
+ *         lpx_mempool_create_aligned_fixed_pool.
+ * @param  addr The address of the object that needs to be freed.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_aligned_free(void *addr)
+{
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    lpx_mempool_fixed_t *pool = NULL;
+
+    if (UNLIKELY(addr == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Slabs are aligned to their size, so masking the address finds the slab header.
+    slab = (lpx_mempool_fixed_slab_t *)((unsigned long)addr & ~(MEMPOOL_ALIGNED_SLAB_SIZE - 1));
+    pool = slab->pool;
+    if (pool->magic != MEMPOOL_FIXED_MAGIC || pool->headerSize != 0) {
+        return MEMPOOL_FAILURE;
+    }
+
+    return freeObject(pool, (long *)addr);
+}
+
+/**
+ * @brief  Turn a free object into the address handed to the caller.
+ * @param  pool The pool the object came from.
+ * @param  object The start of the object, the header if the pool has one.
+ * @return The address for the caller.
+ */
+static inline void *prepObject(lpx_mempool_fixed_t *pool, long *object)
+{
+    if (pool->headerSize != 0) {
+        *object = (long)pool;
+    }
+
+    return (void *)((long)object + pool->headerSize);
+}
+
+/**
+ * @brief  Put an object back into its pool.
+ * @param  pool The pool that the object belongs to.
+ * @param  object The start of the object, the header if the pool has one.
+ * @return 0 on success, -1 on failure.
+ */
+static int freeObject(lpx_mempool_fixed_t *pool, long *object)
+{
+    lpx_mempool_fixed_cache_t *cache = NULL;
+
+    // Park the object in the thread cache, flushing the cache to the pool when full.
+    if (pool->flags & MEMPOOL_THREAD_CACHE) {
+        cache = getThreadCache(pool);
+        if (LIKELY(cache != NULL)) {
+            if (UNLIKELY(cache->count >= MEMPOOL_THREAD_CACHE_SIZE)) {
+                if (0 != flushThreadCache(pool, cache)) {
+                    return MEMPOOL_FAILURE;
+                }
+            }
+
+            cachePush(cache, object);
+            COUNT_STAT(pool->stats, frees, 1);
+            return MEMPOOL_SUCCESS;
+        }
+    }
+
+    COUNT_STAT(pool->stats, frees, 1);
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE) {
+        lockFreePush(pool, object, object);
+        return MEMPOOL_SUCCESS;
+    }
+
+    // Lock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+	    return MEMPOOL_FAILURE;
+	}
+    }
+
+    // Re-link the object into the free list.
+    *object = (long)pool->freeList;
+    pool->freeList = object;
+    pool->freeCount++;
+
+    // Hand whole slabs back once enough objects are free.
+    if (UNLIKELY(pool->lowWaterMark >= 0 && pool->freeCount >= pool->trimThreshold)) {
+        trimFixedPool(pool);
+    }
+
+    // Unlock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+	    return MEMPOOL_FAILURE;
+	}
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Allocate several objects from a fixed sized pool at once. The pool mutex is
+ *         taken (or the compare and swap done) once for the whole batch instead of once
+ *         per object. Thread caches are bypassed.
+ * @param  pool The pool to allocate from.
+ * @param  out  Array that receives the addresses of the objects.
+ * @param  n    The number of objects wanted.
+ * @return The number of objects allocated, which is less than n if the pool ran out,
+ *         -1 on failure.
+ */
+int lpx_mempool_fixed_alloc_bulk(lpx_mempool_fixed_t *pool, void **out, int n)
+{
+    long *object = NULL;
+    int carved = 0;
+    int count = 0;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_FIXED_MAGIC || out == NULL || n < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE) {
+        count = lockFreePopChain(pool, out, n);
+        if (count < n) {
+            object = carveObjects(pool, n - count, &carved);
+            for (i = 0; i < carved; i++) {
+                out[count++] = (void *)((char *)object + i * pool->storedObjectSize);
+            }
+        }
+        while (count < n && pool->slabObjects != 0 && 
+               0 == growFixedPool(pool, pool->slabObjects)) {
+            count += lockFreePopChain(pool, out + count, n - count);
+        }
+    } else {
+        if (pool->poolMutex != NULL) {
+            if (0 != lockPool(pool->poolMutex, pool->stats)) {
+                return MEMPOOL_FAILURE;
+            }
+        }
+
+        while (count < n) {
+            if (pool->freeList == NULL) {
+                pool->freeList = carveObjects(pool, n - count, &carved);
+            }
+            if (pool->freeList == NULL && (pool->flags & MEMPOOL_THREAD_CACHE)) {
+                stealThreadCaches(pool);
+            }
+            if (pool->freeList == NULL && 
+                (pool->slabObjects == 0 || 0 != growFixedPool(pool, pool->slabObjects))) {
+                break;
+            }
+
+            object = (long *)pool->freeList;
+            pool->freeList = (void *)*object;
+            pool->freeCount--;
+            out[count++] = object;
+        }
+
+        if (pool->stats != NULL) {
+            raiseHighWater(pool->stats, pool->numObjects - pool->freeCount);
+        }
+        if (pool->poolMutex != NULL) {
+            pthread_mutex_unlock(pool->poolMutex);
+        }
+    }
+
+    COUNT_STAT(pool->stats, allocs, count);
+    if (count < n) {
+        COUNT_STAT(pool->stats, failedAllocs, 1);
+    }
+
+    // Prep the objects for return to the caller.
+    for (i = 0; i < count; i++) {
+        out[i] = prepObject(pool, (long *)out[i]);
+    }
+
+    return count;
+}
+
+/**
+ * @brief  Free several objects that were allocated on fixed pools at once. Runs of
+ *         objects from the same pool are linked into a chain and handed back to the
+ *         pool under a single lock (or compare and swap). Thread caches are bypassed.
+ *         Objects from aligned pools cannot be freed this way.
+ * @param  objs The objects to free.
+ * @param  n    The number of objects.
+ * @return 0 on success, -1 on failure. On failure the objects before the offending
+ *         one have been freed.
+ */
+int lpx_mempool_fixed_free_bulk(void **objs, int n)
+{
+    lpx_mempool_fixed_t *pool = NULL;
+    long *first = NULL;
+    long *last = NULL;
+    long *object = NULL;
+    int i = 0;
+    int j = 0;
+
+    if (UNLIKELY(objs == NULL || n < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    while (i < n) {
+        if (UNLIKELY(objs[i] == NULL)) {
+            return MEMPOOL_FAILURE;
+        }
+
+        first = (long *)((long)objs[i] - MEMPOOL_PER_OBJECT_OVERHEAD);
+        pool = (lpx_mempool_fixed_t *)*first;
+        if (pool->magic != MEMPOOL_FIXED_MAGIC) {
+            return MEMPOOL_FAILURE;
+        }
+
+        // The header of each object is rewritten as the link to the next one.
+        last = first;
+        for (j = i + 1; j < n && objs[j] != NULL; j++) {
+            object = (long *)((long)objs[j] - MEMPOOL_PER_OBJECT_OVERHEAD);
+            if (*object != (long)pool) {
+                break;
+            }
+            *last = (long)object;
+            last = object;
+        }
+        *last = 0;
+
+        if (0 != freeChain(pool, first, last, j - i)) {
+            return MEMPOOL_FAILURE;
+        }
+        i = j;
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Return a null terminated chain of objects to the shared free list of a pool.
+ * @param  pool The pool the objects belong to.
+ * @param  first The header of the first object.
+ * @param  last The header of the last object.
+ * @param  count The number of objects in the chain.
+ * @return 0 on success, -1 on failure.
+ */
+static int freeChain(lpx_mempool_fixed_t *pool, long *first, long *last, int count)
+{
+    COUNT_STAT(pool->stats, frees, count);
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE) {
+        lockFreePush(pool, first, last);
+        return MEMPOOL_SUCCESS;
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    *last = (long)pool->freeList;
+    pool->freeList = (void *)first;
+    pool->freeCount += count;
+    if (pool->lowWaterMark >= 0 && pool->freeCount >= pool->trimThreshold) {
+        trimFixedPool(pool);
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Destroy all the resources associated with a fixed sized pool.
+ * @param  pool The pool to destroy.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_destroy_fixed_pool(lpx_mempool_fixed_t *pool)
+{
+    lpx_mempool_fixed_cache_t *cache = NULL;
+    lpx_mempool_fixed_slab_t *slab = NULL;
+
+    if (UNLIKELY(pool == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    pool->magic = 0;
+
+    /* Be safe and unlock the address range. */
+    lpx_mempool_unpin_fixed_pool(pool);
+
+    /* Deleting the key first stops exiting threads from touching the caches. */
+    if (pool->flags & MEMPOOL_THREAD_CACHE) {
+        pthread_key_delete(pool->cacheKey);
+        while (pool->caches != NULL) {
+            cache = pool->caches;
+            pool->caches = cache->next;
+            free(cache);
+        }
+    }
+
+    while (pool->slabs != NULL) {
+        slab = pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_destroy(pool->poolMutex);
+        free(pool->poolMutex);
+    }
+
+    if (pool->flags & MEMPOOL_MAPPED) {
+        munmap(pool->pool, mappedSize(pool->poolSize, pool->flags));
+    } else if (pool->flags & MEMPOOL_OWNS_BLOCK) {
+        free(pool->pool);
+    }
+
+    free(pool->stats);
+    pool->stats = NULL;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Take a snapshot of the counters of a pool created with MEMPOOL_STATS. The
+ *         high water mark counts objects parked in thread caches as out of the pool.
+ *         Lock free pools only update it when they run dry and when it is read.
+ * @param  pool  The pool to read.
+ * @param  stats Receives the counters.
+ * @return 0 on success, -1 on failure or if the pool keeps no stats.
+ */
+int lpx_mempool_fixed_get_stats(lpx_mempool_fixed_t *pool, lpx_mempool_stats_t *stats)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_FIXED_MAGIC || stats == NULL || 
+        pool->stats == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    sumStats(pool->stats, stats);
+    stats->bytesInUse = stats->liveObjects * pool->storedObjectSize;
+    stats->capacity = pool->numObjects;
+    raiseHighWater(pool->stats, stats->liveObjects);
+    stats->highWaterMark = pool->stats->highWaterMark;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Find the calling thread's cache for a pool, creating it on first use.
+ * @param  pool The pool that the cache belongs to.
+ * @return The cache on success, NULL on failure.
+ */
+static lpx_mempool_fixed_cache_t *getThreadCache(lpx_mempool_fixed_t *pool)
+{
+    lpx_mempool_fixed_cache_t *cache = pthread_getspecific(pool->cacheKey);
+
+    if (LIKELY(cache != NULL)) {
+        return cache;
+    }
+
+    cache = (lpx_mempool_fixed_cache_t *)malloc(sizeof(lpx_mempool_fixed_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->objects = NULL;
+    cache->count = 0;
+    cache->pool = pool;
+    cache->prev = NULL;
+
+    // Link it into the pool so that it can be stolen from and released.
+    if (0 != lockPool(pool->poolMutex, pool->stats)) {
+        free(cache);
+        return NULL;
+    }
+    cache->next = pool->caches;
+    if (pool->caches != NULL) {
+        pool->caches->prev = cache;
+    }
+    pool->caches = cache;
+    pthread_mutex_unlock(pool->poolMutex);
+
+    if (0 != pthread_setspecific(pool->cacheKey, cache)) {
+        lockPool(pool->poolMutex, pool->stats);
+        unlinkThreadCache(pool, cache);
+        pthread_mutex_unlock(pool->poolMutex);
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Flush a thread cache back into its pool and free it. Runs at thread exit.
+ * @param arg The cache to release.
+ */
+static void releaseThreadCache(void *arg)
+{
+    lpx_mempool_fixed_cache_t *cache = (lpx_mempool_fixed_cache_t *)arg;
+    lpx_mempool_fixed_t *pool = cache->pool;
+
+    if (0 != lockPool(pool->poolMutex, pool->stats)) {
+        return;
+    }
+
+    spliceIntoFreeList(pool, (long *)__sync_lock_test_and_set(&cache->objects, NULL));
+    unlinkThreadCache(pool, cache);
+    pthread_mutex_unlock(pool->poolMutex);
+
+    free(cache);
+}
+
+/**
+ * @brief Remove a cache from the list of caches of its pool. Needs the pool mutex.
+ * @param pool The pool that the cache belongs to.
+ * @param cache The cache to unlink.
+ */
+static void unlinkThreadCache(lpx_mempool_fixed_t *pool, lpx_mempool_fixed_cache_t *cache)
+{
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    } else {
+        pool->caches = cache->next;
+    }
+
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+}
+
+/**
+ * @brief  Pop an object off the calling thread's cache. The compare and swap only
+ *         ever fails if another thread stole the whole chain from under us, and the
+ *         owner is the only one who pushes so the head cannot come back (no ABA).
+ * @param  cache The cache to pop from.
+ * @return The header of the object, NULL if the cache is empty.
+ */
+static long *cachePop(lpx_mempool_fixed_cache_t *cache)
+{
+    long *object = NULL;
+    void *next = NULL;
+
+    do {
+        object = (long *)cache->objects;
+        if (object == NULL) {
+            cache->count = 0;
+            return NULL;
+        }
+        next = (void *)*object;
+    } while (!__sync_bool_compare_and_swap(&cache->objects, object, next));
+
+    cache->count--;
+    return object;
+}
+
+/**
+ * @brief Push an object onto the calling thread's cache.
+ * @param cache The cache to push onto.
+ * @param object The header of the object.
+ */
+static void cachePush(lpx_mempool_fixed_cache_t *cache, long *object)
+{
+    void *head = NULL;
+
+    do {
+        head = cache->objects;
+        *object = (long)head;
+    } while (!__sync_bool_compare_and_swap(&cache->objects, head, object));
+
+    cache->count++;
+}
+
+/**
+ * @brief  Pull a batch of objects from the pool into an empty thread cache. Objects
+ *         only move between the pool and the caches under the pool mutex, so a thread
+ *         stealing from the caches always sees every free object.
+ * @param  pool The pool to refill from.
+ * @param  cache The cache of the calling thread.
+ * @return The header of an object for the caller, NULL if the pool is exhausted.
+ */
+static long *refillThreadCache(lpx_mempool_fixed_t *pool, lpx_mempool_fixed_cache_t *cache)
+{
+    long *object = NULL;
+    long *node = NULL;
+    long *tail = NULL;
+    int carved = 0;
+    int count = 0;
+
+    if (0 != lockPool(pool->poolMutex, pool->stats)) {
+        return NULL;
+    }
+
+    // Never used objects come first, then objects sitting in other threads' caches.
+    // Grow if there are none of either.
+    if (pool->freeList == NULL) {
+        pool->freeList = carveObjects(pool, MEMPOOL_THREAD_CACHE_BATCH, &carved);
+    }
+    if (pool->freeList == NULL) {
+        stealThreadCaches(pool);
+    }
+    if (pool->freeList == NULL && pool->slabObjects != 0) {
+        growFixedPool(pool, pool->slabObjects);
+    }
+
+    object = (long *)pool->freeList;
+    if (object == NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+        return NULL;
+    }
+
+    // Hand the first object to the caller and keep the rest of the batch.
+    node = (long *)*object;
+    while (node != NULL && count < MEMPOOL_THREAD_CACHE_BATCH - 1) {
+        tail = node;
+        node = (long *)*node;
+        count++;
+    }
+    pool->freeList = (void *)node;
+    pool->freeCount -= count + 1;
+    if (pool->stats != NULL) {
+        raiseHighWater(pool->stats, pool->numObjects - pool->freeCount);
+    }
+
+    if (tail != NULL) {
+        *tail = 0;
+        cache->objects = (void *)*object;
+    }
+    cache->count = count;
+
+    pthread_mutex_unlock(pool->poolMutex);
+    return object;
+}
+
+/**
+ * @brief  Return every object in a thread cache to the pool.
+ * @param  pool The pool that the cache belongs to.
+ * @param  cache The cache to flush.
+ * @return 0 on success, -1 on failure.
+ */
+static int flushThreadCache(lpx_mempool_fixed_t *pool, lpx_mempool_fixed_cache_t *cache)
+{
+    if (0 != lockPool(pool->poolMutex, pool->stats)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    spliceIntoFreeList(pool, (long *)__sync_lock_test_and_set(&cache->objects, NULL));
+    cache->count = 0;
+    if (pool->lowWaterMark >= 0 && pool->freeCount >= pool->trimThreshold) {
+        trimFixedPool(pool);
+    }
+
+    if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief Move the contents of every thread cache into the free list. Needs the pool mutex.
+ * @param pool The pool to steal for.
+ */
+static void stealThreadCaches(lpx_mempool_fixed_t *pool)
+{
+    lpx_mempool_fixed_cache_t *cache = pool->caches;
+
+    while (cache != NULL) {
+        spliceIntoFreeList(pool, (long *)__sync_lock_test_and_set(&cache->objects, NULL));
+        cache = cache->next;
+    }
+}
+
+/**
+ * @brief  Prepend a null terminated chain of objects to the free list. Needs the pool
+ *         mutex if the pool is protected.
+ * @param  pool The pool to add the objects to.
+ * @param  chain The first object of the chain, may be NULL.
+ * @return The number of objects in the chain.
+ */
+static int spliceIntoFreeList(lpx_mempool_fixed_t *pool, long *chain)
+{
+    long *tail = chain;
+    int count = 1;
+
+    if (chain == NULL) {
+        return 0;
+    }
+
+    while (*tail != 0) {
+        tail = (long *)*tail;
+        count++;
+    }
+
+    *tail = (long)pool->freeList;
+    pool->freeList = (void *)chain;
+    pool->freeCount += count;
+    return count;
+}
+
+/**
+ * @brief  Take never used objects from the untouched end of a lazily initialized pool.
+ *         Safe to call without the pool mutex, the bump pointer moves atomically.
+ * @param  pool  The pool to take the objects from.
+ * @param  n     The number of objects wanted.
+ * @param  count Receives the number of objects taken, which is less than n near the end.
+ * @return The header of the first object of a null terminated chain, NULL if none are left.
+ */
+static long *carveObjects(lpx_mempool_fixed_t *pool, int n, int *count)
+{
+    char *start = NULL;
+    long available = 0;
+
+    *count = 0;
+    if (pool->bumpNext >= pool->bumpEnd) {
+        return NULL;
+    }
+
+    // Racing callers may push the pointer past the end, they just find nothing there.
+    start = __sync_fetch_and_add(&pool->bumpNext, n * pool->storedObjectSize);
+    if (start >= pool->bumpEnd) {
+        return NULL;
+    }
+
+    available = (pool->bumpEnd - start) / pool->storedObjectSize;
+    *count = available < n ? (int)available : n;
+    threadObjects(start, pool->storedObjectSize, *count);
+    return (long *)start;
+}
+
+/**
+ * @brief  Link every object in a block into a null terminated chain through the headers.
+ * @param  base The start of the block.
+ * @param  storedObjectSize The size of an object including its header.
+ * @param  numObjects The number of objects in the block.
+ * @return The header of the last object.
+ */
+static long *threadObjects(void *base, long storedObjectSize, int numObjects)
+{
+    long *currentBlockHeader = (long *)base;
+    int i = 0;
+
+    for (i = 0; i < numObjects - 1; i++) {
+	// The header points to the next free block.
+        *currentBlockHeader = (long)currentBlockHeader + storedObjectSize;
+	currentBlockHeader = (long *)*currentBlockHeader;
+    }
+    
+    // Now null terminate the list.
+    *currentBlockHeader = 0;
+    return currentBlockHeader;
+}
+
+/**
+ * @brief  Add a slab of objects to a pool. Needs the pool mutex if the pool is
+ *         protected. Lock free pools grow without it, so two threads that run out
+ *         at the same time may both add a slab. Slabs of aligned pools are aligned to
+ *         their size and hold at most as many objects as fit.
+ * @param  pool The pool to grow.
+ * @param  numObjects The number of objects wanted in the slab.
+ * @return 0 on success, -1 on failure.
+ */
+static int growFixedPool(lpx_mempool_fixed_t *pool, int numObjects)
+{
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    long *first = NULL;
+    long *last = NULL;
+    long offset = ALIGN_UP(sizeof(lpx_mempool_fixed_slab_t), pool->alignment);
+    long size = 0;
+
+    if (pool->slabSize != 0) {
+        if (numObjects > (pool->slabSize - offset) / pool->storedObjectSize) {
+            numObjects = (pool->slabSize - offset) / pool->storedObjectSize;
+        }
+        size = pool->slabSize;
+        if (0 != posix_memalign((void **)&slab, size, size)) {
+            return MEMPOOL_FAILURE;
+        }
+    } else {
+        size = offset + pool->storedObjectSize * numObjects;
+        slab = (lpx_mempool_fixed_slab_t *)malloc(size);
+        if (slab == NULL) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+    slab->pool = pool;
+    slab->size = size;
+    slab->numObjects = numObjects;
+
+    if (pool->flags & MEMPOOL_PINNED) {
+        mlock(slab, size);
+    }
+
+    first = (long *)((long)slab + offset);
+    last = threadObjects(first, pool->storedObjectSize, numObjects);
+
+    if ((pool->flags & MEMPOOL_PROTECTION_MASK) == MEMPOOL_LOCKFREE) {
+        do {
+            slab->next = pool->slabs;
+        } while (!__sync_bool_compare_and_swap(&pool->slabs, slab->next, slab));
+        __sync_fetch_and_add(&pool->numObjects, numObjects);
+        lockFreePush(pool, first, last);
+        return MEMPOOL_SUCCESS;
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    *last = (long)pool->freeList;
+    pool->freeList = (void *)first;
+    pool->freeCount += numObjects;
+    pool->numObjects += numObjects;
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief Release slabs whose objects are all on the free list, keeping at least the
+ *        low water mark of free objects. Walks the free list, so it only runs when
+ *        another slab worth of objects was freed since the last time. Needs the pool
+ *        mutex if the pool is protected.
+ * @param pool The pool to trim.
+ */
+static void trimFixedPool(lpx_mempool_fixed_t *pool)
+{
+    lpx_mempool_fixed_slab_t **slabs = NULL;
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    long *object = NULL;
+    long *prev = NULL;
+    int numSlabs = 0;
+    int released = 0;
+    int i = 0;
+
+    for (slab = pool->slabs; slab != NULL; slab = slab->next) {
+        numSlabs++;
+    }
+
+    if (numSlabs == 0) {
+        goto trim_done;
+    }
+
+    slabs = (lpx_mempool_fixed_slab_t **)malloc(numSlabs * sizeof(lpx_mempool_fixed_slab_t *));
+    if (slabs == NULL) {
+        goto trim_done;
+    }
+
+    // Sort the slabs by address so that objects can be matched to them quickly.
+    for (i = 0, slab = pool->slabs; slab != NULL; slab = slab->next, i++) {
+        slab->freeCount = 0;
+        slabs[i] = slab;
+    }
+    qsort(slabs, numSlabs, sizeof(lpx_mempool_fixed_slab_t *), compareSlabs);
+
+    for (object = (long *)pool->freeList; object != NULL; object = (long *)*object) {
+        slab = findSlab(slabs, numSlabs, object);
+        if (slab != NULL) {
+            slab->freeCount++;
+        }
+    }
+
+    // Pick the slabs to release, marking them with a negative free count.
+    for (slab = pool->slabs; slab != NULL; slab = slab->next) {
+        if (slab->freeCount == slab->numObjects &&
+            pool->freeCount - slab->numObjects >= pool->lowWaterMark) {
+            slab->freeCount = -1;
+            pool->freeCount -= slab->numObjects;
+            pool->numObjects -= slab->numObjects;
+            released++;
+        }
+    }
+
+    if (released == 0) {
+        goto trim_done;
+    }
+
+    // Drop the objects of those slabs from the free list and then the slabs themselves.
+    prev = NULL;
+    for (object = (long *)pool->freeList; object != NULL; object = (long *)*object) {
+        slab = findSlab(slabs, numSlabs, object);
+        if (slab != NULL && slab->freeCount < 0) {
+            continue;
+        }
+
+        if (prev == NULL) {
+            pool->freeList = (void *)object;
+        } else {
+            *prev = (long)object;
+        }
+        prev = object;
+    }
+    if (prev == NULL) {
+        pool->freeList = NULL;
+    } else {
+        *prev = 0;
+    }
+
+    pool->slabs = NULL;
+    for (i = numSlabs - 1; i >= 0; i--) {
+        if (slabs[i]->freeCount < 0) {
+            if (pool->flags & MEMPOOL_PINNED) {
+                munlock(slabs[i], slabs[i]->size);
+            }
+            free(slabs[i]);
+        } else {
+            slabs[i]->next = pool->slabs;
+            pool->slabs = slabs[i];
+        }
+    }
+
+trim_done:
+    free(slabs);
+    pool->trimThreshold = pool->freeCount + pool->slabObjects;
+    if (pool->trimThreshold < pool->lowWaterMark + pool->slabObjects) {
+        pool->trimThreshold = pool->lowWaterMark + pool->slabObjects;
+    }
+}
+
+/**
+ * @brief  Find the slab that an object lives in.
+ * @param  slabs The slabs of the pool sorted by address.
+ * @param  numSlabs The number of slabs.
+ * @param  object The header of the object.
+ * @return The slab, NULL if the object is in the block the pool was created with.
+ */
+static lpx_mempool_fixed_slab_t *findSlab(lpx_mempool_fixed_slab_t **slabs, int numSlabs,
+                                          long *object)
+{
+    int low = 0;
+    int high = numSlabs - 1;
+    int mid = 0;
+
+    while (low <= high) {
+        mid = (low + high) / 2;
+        if ((unsigned long)object < (unsigned long)slabs[mid]) {
+            high = mid - 1;
+        } else if ((unsigned long)object >= (unsigned long)slabs[mid] + slabs[mid]->size) {
+            low = mid + 1;
+        } else {
+            return slabs[mid];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  qsort comparator that orders slabs by address.
+ * @param  a Pointer to the first slab.
+ * @param  b Pointer to the second slab.
+ * @return Less than, equal to or greater than 0 like strcmp.
+ */
+static int compareSlabs(const void *a, const void *b)
+{
+    unsigned long first = (unsigned long)*(lpx_mempool_fixed_slab_t * const *)a;
+    unsigned long second = (unsigned long)*(lpx_mempool_fixed_slab_t * const *)b;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief  Pop an object off the free list of a lock free pool. Reading the header of
+ *         an object that another thread popped first is harmless, the pool memory stays
+ *         mapped and the tag makes the compare and swap fail.
+ * @param  pool The pool to pop from.
+ * @return The header of the object, NULL if the pool is exhausted.
+ */
+static long *lockFreePop(lpx_mempool_fixed_t *pool)
+{
+    lpx_mempool_tagged_head_t current;
+    lpx_mempool_tagged_head_t next;
+    volatile lpx_mempool_tagged_head_t *list = &pool->lockFreeList;
+
+    do {
+        current.tag = list->tag;
+        current.head = list->head;
+        if (current.head == NULL) {
+            return NULL;
+        }
+
+        next.head = (void *)*(volatile long *)current.head;
+        next.tag = current.tag + 1;
+    } while (!casTaggedHead(&pool->lockFreeList, current, next));
+
+    return (long *)current.head;
+}
+
+/**
+ * @brief  Pop up to n objects off the free list of a lock free pool with a single
+ *         compare and swap. The walk may follow stale links if another thread got in
+ *         first, but then the tag has moved on and the swap fails. A stale link is
+ *         either another object or the pool itself, whose first word is NULL for lock
+ *         free pools, so the walk always terminates.
+ * @param  pool The pool to pop from.
+ * @param  out  Array that receives the headers of the objects.
+ * @param  n    The maximum number of objects to pop.
+ * @return The number of objects popped.
+ */
+static int lockFreePopChain(lpx_mempool_fixed_t *pool, void **out, int n)
+{
+    lpx_mempool_tagged_head_t current;
+    lpx_mempool_tagged_head_t next;
+    volatile lpx_mempool_tagged_head_t *list = &pool->lockFreeList;
+    long *node = NULL;
+    int count = 0;
+
+    // Objects without a header keep user data where the link was, a stale link could
+    // point anywhere. Pop those one at a time instead.
+    if (pool->headerSize == 0) {
+        while (count < n && (node = lockFreePop(pool)) != NULL) {
+            out[count++] = (void *)node;
+        }
+        return count;
+    }
+
+    do {
+        current.tag = list->tag;
+        current.head = list->head;
+
+        count = 0;
+        node = (long *)current.head;
+        while (node != NULL && count < n) {
+            out[count++] = (void *)node;
+            node = (long *)*(volatile long *)node;
+        }
+
+        if (count == 0) {
+            return 0;
+        }
+
+        next.head = (void *)node;
+        next.tag = current.tag + 1;
+    } while (!casTaggedHead(&pool->lockFreeList, current, next));
+
+    return count;
+}
+
+/**
+ * @brief Push a null terminated chain of objects onto the free list of a lock free pool.
+ * @param pool The pool to push onto.
+ * @param first The header of the first object in the chain.
+ * @param last The header of the last object in the chain.
+ */
+static void lockFreePush(lpx_mempool_fixed_t *pool, long *first, long *last)
+{
+    lpx_mempool_tagged_head_t current;
+    lpx_mempool_tagged_head_t next;
+    volatile lpx_mempool_tagged_head_t *list = &pool->lockFreeList;
+
+    next.head = (void *)first;
+    do {
+        current.tag = list->tag;
+        current.head = list->head;
+        *last = (long)current.head;
+        next.tag = current.tag + 1;
+    } while (!casTaggedHead(&pool->lockFreeList, current, next));
+}
+
+/**
+ * @brief  Compare and swap both words of a tagged list head at once (cmpxchg16b).
+ * @param  list The list head to update.
+ * @param  expected The value the head must still have.
+ * @param  desired The value to replace it with.
+ * @return Non zero if the head was updated.
+ */
+static int casTaggedHead(lpx_mempool_tagged_head_t *list,
+                         lpx_mempool_tagged_head_t expected,
+                         lpx_mempool_tagged_head_t desired)
+{
+    union {
+        lpx_mempool_tagged_head_t head;
+        unsigned __int128 value;
+    } oldValue, newValue;
+
+    oldValue.head = expected;
+    newValue.head = desired;
+    return __sync_bool_compare_and_swap((unsigned __int128 *)list, 
+                                        oldValue.value, newValue.value);
+}
+
+
+/**
+ * @brief  Create a memory pool of variable sized objects that is split into arenas, each
+ *         with its own memory and mutex. Threads are handed out arenas round robin the
+ *         first time they allocate, and stick to them. Objects go back to the arena they
+ *         came from when they are freed, whichever thread frees them. Containers created
+ *         from the pool allocate from the arena of the calling thread as well.
+ * @param  pool The pool to create.
+ * @param  size The size of every arena.
+ * @param  isProtected The flags, as for lpx_mempool_create_variable_pool. Arenas only
+ *                     pay off when the pool is protected.
+ * @param  numArenas The number of arenas, 0 for one per online CPU.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_variable_pool_with_arenas(lpx_mempool_variable_t *pool, long size,
+                                                int isProtected, int numArenas)
+{
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || numArenas < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (numArenas == 0) {
+        numArenas = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numArenas < 1) {
+            numArenas = 1;
+        }
+    }
+
+    if (0 != lpx_mempool_create_variable_pool(pool, size, isProtected)) {
+        return MEMPOOL_FAILURE;
+    }
+    if (numArenas == 1) {
+        return MEMPOOL_SUCCESS;
+    }
+
+    // The pool itself is the first arena.
+    pool->arenas = (lpx_mempool_variable_t *)calloc(numArenas - 1, 
+                                                    sizeof(lpx_mempool_variable_t));
+    if (pool->arenas == NULL) {
+        goto cleanup;
+    }
+
+    for (i = 0; i < numArenas - 1; i++) {
+        if (0 != lpx_mempool_create_variable_pool(&pool->arenas[i], size, isProtected)) {
+            goto cleanup;
+        }
+    }
+    pool->numArenas = numArenas;
+
+    return MEMPOOL_SUCCESS;
+
+cleanup:
+    while (--i >= 0) {
+        lpx_mempool_destroy_variable_pool(&pool->arenas[i]);
+    }
+    free(pool->arenas);
+    pool->arenas = NULL;
+    lpx_mempool_destroy_variable_pool(pool);
+    return MEMPOOL_FAILURE;
+}
+
+/**
+ * @brief  Create a memory pool that can allocate variable sized objects inside an
+ *         existing block of memory.
+ * @param  pool The pool to allocate create.
+ * @param  size The total size of the block provided.
+ * @param  isProtected Should the pool be protected by a mutex?
+ * @param  base The block of memory for the pool to be created in.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_variable_pool_from_block(lpx_mempool_variable_t *pool, 
+                                                long size, 
+						int isProtected, 
+						void *base)
+{
+    long *blockMetadata = NULL;
+
+    if (UNLIKELY(pool == NULL || base == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Block sizes are kept in whole longs, so the headers stay aligned.
+    size &= ~(long)(sizeof(long) - 1);
+    if (size < VPMD_MIN_BLOCK_SIZE + VPMD_END_SIZE) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if ((isProtected & MEMPOOL_PROTECTION_MASK) == MEMPOOL_PROTECTED) {
+        pool->poolMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+	if (pool->poolMutex == NULL) {
+	    return MEMPOOL_FAILURE;
+	}
+     
+        if (0 != pthread_mutex_init(pool->poolMutex, NULL)) {
+	    free(pool->poolMutex);
+	    return MEMPOOL_FAILURE;
+	}
+    } else {
+        pool->poolMutex = NULL;
+    }
+
+    pool->stats = NULL;
+    if (isProtected & MEMPOOL_STATS) {
+        pool->stats = createStats();
+        if (pool->stats == NULL) {
+            goto cleanup_mutex;
+        }
+    }
+
+    pool->tlsf = NULL;
+    if (isProtected & MEMPOOL_TLSF) {
+        pool->tlsf = (lpx_mempool_tlsf_t *)calloc(1, sizeof(lpx_mempool_tlsf_t));
+        if (pool->tlsf == NULL) {
+            goto cleanup_stats;
+        }
+    }
+
+    // Allocate all the memory up front.
+    // size -= MEMPOOL_PER_BLOCK_OVERHEAD;
+    pool->pool = base;
+    pool->poolSize = size;
+    pool->flags = isProtected;
+    memset(pool->bins, 0, sizeof(pool->bins));
+    pool->binMap = 0;
+    pool->extents = NULL;
+    pool->extentSize = 0;
+    pool->maxSize = 0;
+    pool->capacity = 0;
+    pool->arenas = NULL;
+    pool->numArenas = 1;
+
+    // The whole block starts out as one free block.
+    blockMetadata = (long *)pool->pool;
+    initRegion(pool, blockMetadata, pool->poolSize);
+    
+    // Finally, set the flag to indicate that this pool is valid.
+    pool->magic = MEMPOOL_VARIABLE_MAGIC;
+
+    return MEMPOOL_SUCCESS;
+
+cleanup_stats:
+    free(pool->stats);
+    pool->stats = NULL;
+
+cleanup_mutex:
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_destroy(pool->poolMutex);
+        free(pool->poolMutex);
+        pool->poolMutex = NULL;
+    }
+    return MEMPOOL_FAILURE;
+}
+
+
+
+/**
+ * @brief  Create a memory pool that can allocate variable sized objects.
+ * @param  pool The pool to allocate from.
+ * @param  size The total size of the memory pool.
+ * @param  isProtected Should the pool be protected by a mutex? May be or'ed with
+ *                     MEMPOOL_HUGEPAGES and MEMPOOL_POPULATE, in which case the
+ *                     pool also gets the memory that rounding to pages adds, and
+ *                     with MEMPOOL_STATS and MEMPOOL_TLSF.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_variable_pool(lpx_mempool_variable_t *pool, 
+                                     long size, int isProtected)
+{
+    if (UNLIKELY(pool == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Allocate all the memory up front, with room for the header of one object of
+    // the whole size and the end of the pool.
+    size += MEMPOOL_PER_BLOCK_OVERHEAD + VPMD_END_SIZE;
+    void *base = NULL;
+    if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+        // The rounding is mapped anyway, so hand all of it to the pool.
+        size = mappedSize(size, isProtected);
+        base = mapPoolMemory(size, isProtected);
+    } else {
+        base = malloc(size);
+    }
+    if (base == NULL) {
+	return MEMPOOL_FAILURE;
+    }
+
+    if (0 != lpx_mempool_create_variable_pool_from_block(pool, size, isProtected, base)) {
+        if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+            munmap(base, size);
+        } else {
+            free(base);
+        }
+        return MEMPOOL_FAILURE;
+    }
+
+    // The block came from us, so destroying the pool should release it too.
+    pool->flags |= MEMPOOL_OWNS_BLOCK;
+    if (isProtected & (MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE)) {
+        pool->flags |= MEMPOOL_MAPPED;
+    }
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Work out how much memory a mapped pool block of a given size takes up.
+ * @param  size  The size of the block.
+ * @param  flags The creation flags of the pool.
+ * @return The size rounded up to a whole number of (huge) pages.
+ */
+static long mappedSize(long size, int flags)
+{
+    if (flags & MEMPOOL_HUGEPAGES) {
+        return ALIGN_UP(size, MEMPOOL_HUGE_PAGE_SIZE);
+    }
+
+    return ALIGN_UP(size, sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief  Map the block of memory for a pool created with MEMPOOL_HUGEPAGES or MEMPOOL_POPULATE.
+ *         Reserved huge pages are tried first. If there are none, the block is aligned to a
+ *         huge page boundary and advised for transparent huge pages instead.
+ * @param  size  The size of the block. The mapping is rounded up with mappedSize.
+ * @param  flags The creation flags of the pool.
+ * @return The block on success, NULL on failure.
+ */
+static void *mapPoolMemory(long size, int flags)
+{
+    int mapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *base = NULL;
+    char *aligned = NULL;
+    char *page = NULL;
+
+    size = mappedSize(size, flags);
+    if (flags & MEMPOOL_POPULATE) {
+        mapFlags |= MAP_POPULATE;
+    }
+
+    if (!(flags & MEMPOOL_HUGEPAGES)) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, mapFlags, -1, 0);
+        return base == MAP_FAILED ? NULL : base;
+    }
+
+#ifdef MAP_HUGETLB
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, mapFlags | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) {
+        return base;
+    }
+#endif
+
+    // Transparent huge pages only cover aligned ranges, so map a huge page extra and trim it.
+    base = mmap(NULL, size + MEMPOOL_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    aligned = (char *)ALIGN_UP((unsigned long)base, MEMPOOL_HUGE_PAGE_SIZE);
+    if (aligned != base) {
+        munmap(base, aligned - base);
+    }
+    munmap(aligned + size, base + MEMPOOL_HUGE_PAGE_SIZE - aligned);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+    // Prefault only after the advice, otherwise the range fills up with small pages.
+    if (flags & MEMPOOL_POPULATE) {
+        for (page = aligned; page < aligned + size; page += pageSize) {
+            *(volatile char *)page = 0;
+        }
+    }
+
+    return aligned;
+}
+
+/**
+ * @brief  Pin the memory that is backing the pool in RAM, extents included.
+ * @param  The memory pool to pin.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_pin_variable_pool(lpx_mempool_variable_t *pool)
+{
+    lpx_mempool_variable_extent_t *extent = NULL;
+    int retval = 0;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        if (0 != lpx_mempool_pin_variable_pool(&pool->arenas[i])) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    // Extents that the pool grows later on are pinned as they are mapped.
+    pool->flags |= MEMPOOL_PINNED;
+    retval = mlock(pool->pool, pool->poolSize);
+    for (extent = pool->extents; extent != NULL && retval == 0; extent = extent->next) {
+        retval = mlock(extent, extent->size);
+    }
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+    }
+
+    return retval;
+}
+
+/**
+ * @brief  Unpin the memory that is backing the pool from RAM.
+ * @param  The memory pool to unpin.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_unpin_variable_pool(lpx_mempool_variable_t *pool)
+{
+    lpx_mempool_variable_extent_t *extent = NULL;
+    int retval = 0;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        lpx_mempool_unpin_variable_pool(&pool->arenas[i]);
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    pool->flags &= ~MEMPOOL_PINNED;
+    retval = munlock(pool->pool, pool->poolSize);
+    for (extent = pool->extents; extent != NULL && retval == 0; extent = extent->next) {
+        retval = munlock(extent, extent->size);
+    }
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+    }
+
+    return retval;
+}
+
+/**
+ * @brief  Allocate a variable sized object on the memory pool.
+ * @param  pool The pool to allocate from.
+ * @param  size The size of the object to allocate.
+ * @return A valid address on success, NULL on failure.
+ */
+void *lpx_mempool_variable_alloc(lpx_mempool_variable_t *pool, long size)
+{
+    void *candidateBlock = NULL;
     int unlockNeeded = 0;
     
-    if (UNLIKELY(pool == NULL)) {
+    if (UNLIKELY(pool == NULL || size < 0)) {
+        return NULL;
+    }
+
+    if (pool->arenas != NULL) {
+        pool = threadArena(pool);
+    }
+
+    // Lock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+	    return NULL;
+	}
+	unlockNeeded = 1;
+    }
+
+    // First off, adjust the size to accomodate the metadata and keep the next header aligned.
+    size = ALIGN_UP(size + MEMPOOL_PER_BLOCK_OVERHEAD, sizeof(long));
+    if (size < VPMD_MIN_BLOCK_SIZE) {
+        // Because this should be linkable back into the list.
+	size = VPMD_MIN_BLOCK_SIZE;
+    }
+
+    // Find a block that fits from the size bins or the TLSF index.
+    candidateBlock = findFit(pool, size);
+    if (candidateBlock == NULL) {
+        if (unlockNeeded) {
+	    pthread_mutex_unlock(pool->poolMutex);
+	}
+        COUNT_STAT(pool->stats, failedAllocs, 1);
+        return NULL;
+    }
+    
+    // Split the block and give the remainder back.
+    candidateBlock = splitBlock(pool, candidateBlock, &size);
+
+    // Prep the block for return.
+    ((long *)candidateBlock)[0] = (long)pool;
+    if (pool->stats != NULL) {
+        COUNT_STAT(pool->stats, allocs, 1);
+        COUNT_STAT(pool->stats, bytesAllocated, size);
+        raiseHighWater(pool->stats, ++pool->stats->liveObjects);
+    }
+
+    // Unlock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+	    return NULL;
+	}
+    }
+
+    // &candidateBlock[2] is the start of the user memory block.
+    return &(((long *)candidateBlock)[2]);
+}
+
+/**
+ * @brief  Allocate a variable sized object at an address that is a multiple of the
+ *         given alignment. The slack in front of it is split off as a free block of
+ *         its own, so it can still be used by other allocations.
+ * @param  pool The pool to allocate from.
+ * @param  alignment The alignment, a power of two.
+ * @param  size The size of the object to allocate.
+ * @return A valid address on success, NULL on failure. It is freed with
+ *         lpx_mempool_variable_free, and stays aligned when it is resized in place.
+ */
+void *lpx_mempool_variable_memalign(lpx_mempool_variable_t *pool, long alignment, long size)
+{
+    long *block = NULL;
+    long *rest = NULL;
+    long blockSize = 0;
+    long lead = 0;
+    char *addr = NULL;
+
+    if (UNLIKELY(pool == NULL || size < 0 || alignment <= 0 || 
+                 (alignment & (alignment - 1)) != 0)) {
+        return NULL;
+    }
+
+    // Every block is aligned to a long already.
+    if (alignment <= (long)sizeof(long)) {
+        return lpx_mempool_variable_alloc(pool, size);
+    }
+
+    if (pool->arenas != NULL) {
+        pool = threadArena(pool);
+    }
+
+    size = ALIGN_UP(size + MEMPOOL_PER_BLOCK_OVERHEAD, sizeof(long));
+    if (size < VPMD_MIN_BLOCK_SIZE) {
+	size = VPMD_MIN_BLOCK_SIZE;
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+	    return NULL;
+	}
+    }
+
+    // The slack in front is either nothing or large enough to be a free block, so
+    // looking for this much always leaves room for the object.
+    block = findFit(pool, size + alignment + VPMD_MIN_BLOCK_SIZE);
+    if (block == NULL) {
+        if (pool->poolMutex != NULL) {
+	    pthread_mutex_unlock(pool->poolMutex);
+	}
+        COUNT_STAT(pool->stats, failedAllocs, 1);
+        return NULL;
+    }
+
+    addr = (char *)ALIGN_UP((unsigned long)(block + 2), alignment);
+    lead = addr - (char *)(block + 2);
+    while (lead != 0 && lead < VPMD_MIN_BLOCK_SIZE) {
+        addr += alignment;
+        lead += alignment;
+    }
+
+    rest = block;
+    if (lead != 0) {
+        // Give the slack back, the rest of the block is split as usual.
+        blockSize = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+        indexRemove(pool, block);
+        tagFreeBlock(block, lead);
+        indexInsert(pool, block);
+        rest = (long *)((char *)block + lead);
+        rest[0] = (long)pool;
+        tagFreeBlock(rest, blockSize - lead);
+        indexInsert(pool, rest);
+    }
+    rest = (long *)splitBlock(pool, rest, &size);
+    if (lead != 0) {
+        rest[VPMD_TAG_OFFSET] |= VPMD_PREV_FREE;
+    }
+
+    rest[0] = (long)pool;
+    if (pool->stats != NULL) {
+        COUNT_STAT(pool->stats, allocs, 1);
+        COUNT_STAT(pool->stats, bytesAllocated, size);
+        raiseHighWater(pool->stats, ++pool->stats->liveObjects);
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+	    return NULL;
+	}
+    }
+
+    return addr;
+}
+
+/**
+ * @brief  Free an object that was allocated on variable sized memory pool.
+ * @param  addr The address of the object to free.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_variable_free(void *addr)
+{
+    lpx_mempool_variable_t *pool = NULL;
+    long size = 0;
+    long *originalBlock = (long *)addr;
+
+    if (UNLIKELY(addr == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Find the pool that this block points to & the size of the block.
+    originalBlock -= 2;
+    pool = (lpx_mempool_variable_t *)originalBlock[0];
+    size = originalBlock[1] & VPMD_SIZE_MASK;
+    if (pool->magic != MEMPOOL_VARIABLE_MAGIC) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Lock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+	    return MEMPOOL_FAILURE;
+	}
+    }
+
+    // The tag tells when a block is freed twice.
+    if (UNLIKELY(originalBlock[VPMD_TAG_OFFSET] & VPMD_BLOCK_FREE)) {
+        if (pool->poolMutex != NULL) {
+            pthread_mutex_unlock(pool->poolMutex);
+        }
+        return MEMPOOL_FAILURE;
+    }
+
+    // Merge the block with its free neighbours and put it back into the index.
+    freeBlock(pool, originalBlock);
+    if (pool->stats != NULL) {
+        COUNT_STAT(pool->stats, frees, 1);
+        COUNT_STAT(pool->stats, bytesFreed, size);
+        pool->stats->liveObjects--;
+    }
+
+    // Unlock the mutex if needed.
+    if (pool->poolMutex != NULL) {
+        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
+	    return MEMPOOL_FAILURE;
+	}
+    }
+ 
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Resize an object of a variable sized memory pool. The object grows in place
+ *         if the block after it is free and large enough, and shrinks in place by
+ *         giving its tail back. Only otherwise it is moved to a new block.
+ * @param  pool The pool the object belongs to.
+ * @param  addr The object to resize, NULL to allocate a new one.
+ * @param  size The new size of the object.
+ * @return The address of the resized object, NULL on failure, in which case the old
+ *         object is left untouched.
+ */
+void *lpx_mempool_variable_realloc(lpx_mempool_variable_t *pool, void *addr, long size)
+{
+    lpx_mempool_variable_t *owner = NULL;
+    long *block = NULL;
+    long *next = NULL;
+    long blockSize = 0;
+    long newSize = 0;
+    long available = 0;
+    void *newAddr = NULL;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || size < 0)) {
+        return NULL;
+    }
+
+    if (addr == NULL) {
+        return lpx_mempool_variable_alloc(pool, size);
+    }
+
+    // With arenas the object may belong to any of them, it is resized in its own.
+    block = (long *)addr - 2;
+    owner = (lpx_mempool_variable_t *)block[0];
+    if (UNLIKELY(!isArenaOf(pool, owner) || (block[VPMD_TAG_OFFSET] & VPMD_BLOCK_FREE))) {
+        return NULL;
+    }
+
+    newSize = ALIGN_UP(size + MEMPOOL_PER_BLOCK_OVERHEAD, sizeof(long));
+    if (newSize < VPMD_MIN_BLOCK_SIZE) {
+        newSize = VPMD_MIN_BLOCK_SIZE;
+    }
+
+    // Lock the mutex if needed.
+    if (owner->poolMutex != NULL) {
+        if (0 != lockPool(owner->poolMutex, owner->stats)) {
+	    return NULL;
+	}
+    }
+
+    blockSize = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+    next = (long *)((char *)block + blockSize);
+    available = blockSize;
+    if (next[VPMD_TAG_OFFSET] & VPMD_BLOCK_FREE) {
+        available += next[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+    }
+
+    if (newSize <= available) {
+        if (available != blockSize) {
+            // Take the free block after this one in, the tail goes back below.
+            indexRemove(owner, next);
+            next = (long *)((char *)block + available);
+            next[VPMD_TAG_OFFSET] &= ~VPMD_PREV_FREE;
+        }
+
+        if (available - newSize >= VPMD_MIN_BLOCK_SIZE) {
+            // Free the tail as an object of its own, so it merges with what follows it.
+            next = (long *)((char *)block + newSize);
+            next[0] = (long)owner;
+            next[VPMD_TAG_OFFSET] = available - newSize;
+            freeBlock(owner, next);
+        } else {
+            newSize = available;
+        }
+
+        block[VPMD_TAG_OFFSET] = newSize | (block[VPMD_TAG_OFFSET] & VPMD_PREV_FREE);
+        if (newSize > blockSize) {
+            COUNT_STAT(owner->stats, bytesAllocated, newSize - blockSize);
+        } else {
+            COUNT_STAT(owner->stats, bytesFreed, blockSize - newSize);
+        }
+
+        if (owner->poolMutex != NULL) {
+            pthread_mutex_unlock(owner->poolMutex);
+        }
+        return addr;
+    }
+
+    if (owner->poolMutex != NULL) {
+        pthread_mutex_unlock(owner->poolMutex);
+    }
+
+    // No room next to it, so move it.
+    newAddr = lpx_mempool_variable_alloc(pool, size);
+    if (newAddr == NULL) {
+        return NULL;
+    }
+    memcpy(newAddr, addr, blockSize - MEMPOOL_PER_BLOCK_OVERHEAD);
+    lpx_mempool_variable_free(addr);
+
+    return newAddr;
+}
+
+/**
+ * @brief  Release all the resources associated with this pool.
+ * @param  pool The pool to destroy.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_destroy_variable_pool(lpx_mempool_variable_t *pool)
+{
+    lpx_mempool_variable_extent_t *extent = NULL;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || pool->pool == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        lpx_mempool_destroy_variable_pool(&pool->arenas[i]);
+    }
+    free(pool->arenas);
+    pool->arenas = NULL;
+    pool->numArenas = 1;
+
+    /* Be safe and shoot off a call to munlock this address range. */
+    lpx_mempool_unpin_variable_pool(pool);
+
+    while (pool->extents != NULL) {
+        extent = pool->extents;
+        pool->extents = extent->next;
+        munmap(extent, extent->size);
+    }
+
+    if (pool->flags & MEMPOOL_MAPPED) {
+        munmap(pool->pool, pool->poolSize);
+    } else if (pool->flags & MEMPOOL_OWNS_BLOCK) {
+        free(pool->pool);
+    }
+
+    free(pool->stats);
+    pool->stats = NULL;
+    free(pool->tlsf);
+    pool->tlsf = NULL;
+    
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_destroy(pool->poolMutex);
+	free(pool->poolMutex);
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Take a snapshot of the counters of a pool created with MEMPOOL_STATS. The
+ *         counters of a pool with arenas are added up, its high water mark is the sum
+ *         of those of the arenas.
+ * @param  pool  The pool to read.
+ * @param  stats Receives the counters.
+ * @return 0 on success, -1 on failure or if the pool keeps no stats.
+ */
+int lpx_mempool_variable_get_stats(lpx_mempool_variable_t *pool, lpx_mempool_stats_t *stats)
+{
+    lpx_mempool_stats_t arena;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || stats == NULL || 
+        pool->stats == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    sumStats(pool->stats, stats);
+    stats->capacity = pool->capacity;
+    stats->highWaterMark = pool->stats->highWaterMark;
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        lpx_mempool_variable_get_stats(&pool->arenas[i], &arena);
+        stats->liveObjects += arena.liveObjects;
+        stats->highWaterMark += arena.highWaterMark;
+        stats->allocs += arena.allocs;
+        stats->frees += arena.frees;
+        stats->failedAllocs += arena.failedAllocs;
+        stats->bytesInUse += arena.bytesInUse;
+        stats->capacity += arena.capacity;
+        stats->contended += arena.contended;
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Report how the free memory of a variable pool is split up. Every free block
+ *         is visited under the pool mutex, so this is meant for diagnostics rather than
+ *         the allocation path. A pool with arenas reports on all of them together.
+ * @param  pool The pool to inspect.
+ * @param  frag Receives the report.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_variable_get_fragmentation(lpx_mempool_variable_t *pool, 
+                                           lpx_mempool_frag_t *frag)
+{
+    lpx_mempool_variable_t *arena = NULL;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || frag == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    memset(frag, 0, sizeof(lpx_mempool_frag_t));
+    for (i = 0; i < pool->numArenas; i++) {
+        arena = (i == 0) ? pool : &pool->arenas[i - 1];
+        if (arena->poolMutex != NULL) {
+            if (0 != lockPool(arena->poolMutex, arena->stats)) {
+                return MEMPOOL_FAILURE;
+            }
+        }
+
+        visitFreeLists(arena, countFreeBlocks, frag);
+
+        if (arena->poolMutex != NULL) {
+            pthread_mutex_unlock(arena->poolMutex);
+        }
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Let a variable pool grow instead of failing allocations once it runs out.
+ *         Every time no free block fits, the pool maps another extent of extentSize
+ *         bytes, or one just large enough for the request if that is more. Extents
+ *         honour MEMPOOL_HUGEPAGES and MEMPOOL_POPULATE like the pool itself, and are
+ *         only given back by lpx_mempool_purge_variable_pool. Every arena of a pool
+ *         grows on its own up to maxSize.
+ * @param  pool       The pool to configure.
+ * @param  extentSize The size of an extent, 0 to stop growing.
+ * @param  maxSize    The most that the capacity of the pool may grow to, 0 for no limit.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_set_variable_pool_growth(lpx_mempool_variable_t *pool, long extentSize,
+                                         long maxSize)
+{
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || extentSize < 0 ||
+                 maxSize < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        if (0 != lpx_mempool_set_variable_pool_growth(&pool->arenas[i], extentSize, maxSize)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    pool->extentSize = extentSize;
+    pool->maxSize = maxSize;
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Give idle memory of a variable pool back to the operating system. Extents
+ *         without a single allocated block are unmapped, and the pages inside free
+ *         blocks of at least minSize bytes are dropped with MADV_DONTNEED. They are
+ *         faulted back in as zero pages once they are allocated again. Pinned pools
+ *         keep the pages of their free blocks and only unmap idle extents.
+ * @param  pool    The pool to purge.
+ * @param  minSize Free blocks smaller than this are left alone.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_purge_variable_pool(lpx_mempool_variable_t *pool, long minSize)
+{
+    lpx_mempool_variable_extent_t **link = NULL;
+    lpx_mempool_variable_extent_t *extent = NULL;
+    long *block = NULL;
+    long size = 0;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    for (i = 0; i < pool->numArenas - 1; i++) {
+        if (0 != lpx_mempool_purge_variable_pool(&pool->arenas[i], minSize)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    if (pool->poolMutex != NULL) {
+        if (0 != lockPool(pool->poolMutex, pool->stats)) {
+            return MEMPOOL_FAILURE;
+        }
+    }
+
+    // An extent is idle when its first block is free and spans all of it.
+    link = &pool->extents;
+    while (*link != NULL) {
+        extent = *link;
+        block = (long *)(extent + 1);
+        size = extent->size - sizeof(lpx_mempool_variable_extent_t) - VPMD_END_SIZE;
+        if ((block[VPMD_TAG_OFFSET] & VPMD_BLOCK_FREE) && 
+            (block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK) == size) {
+            indexRemove(pool, block);
+            pool->capacity -= size;
+            *link = extent->next;
+            munmap(extent, extent->size);
+        } else {
+            link = &extent->next;
+        }
+    }
+
+    // Locked pages cannot be dropped, a pinned pool only gives back whole extents.
+    if (!(pool->flags & MEMPOOL_PINNED)) {
+        visitFreeLists(pool, purgeFreeBlocks, &minSize);
+    }
+
+    if (pool->poolMutex != NULL) {
+        pthread_mutex_unlock(pool->poolMutex);
+    }
+
+    return MEMPOOL_SUCCESS;
+}
+
+/**
+ * @brief  Create a general purpose pool that serves requests of up to MEMPOOL_SIZED_MAX_SMALL
+ *         bytes from fixed pools, one per size class, and larger ones from a variable pool.
+ *         The size classes start out with a slab's worth of objects that is only touched
+ *         once used, and grow and shrink a slab at a time.
+ * @param  pool        The pool to create.
+ * @param  largeSize   The size of the variable pool for larger requests, 0 for none.
+ * @param  isProtected The protection mode and flags of the size classes. See
+ *                     lpx_mempool_create_fixed_pool. The variable pool is protected
+ *                     by a mutex unless the size classes are unprotected.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_create_sized_pool(lpx_mempool_sized_t *pool, long largeSize, int isProtected)
+{
+    int protection = isProtected & MEMPOOL_PROTECTION_MASK;
+    int largeFlags = isProtected & ~(MEMPOOL_PROTECTION_MASK | MEMPOOL_THREAD_CACHE | MEMPOOL_LAZY_INIT);
+    long objectSize = 0;
+    int slabObjects = 0;
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || largeSize < 0)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    pool->hasLarge = 0;
+    if (largeSize > 0) {
+        largeFlags |= protection == MEMPOOL_UNPROTECTED ? MEMPOOL_UNPROTECTED : MEMPOOL_PROTECTED;
+        if (0 != lpx_mempool_create_variable_pool(&pool->large, largeSize, largeFlags)) {
+            return MEMPOOL_FAILURE;
+        }
+        pool->hasLarge = 1;
+    }
+
+    for (i = 0; i < MEMPOOL_SIZED_CLASSES; i++) {
+        objectSize = sizeClassSize(i);
+        slabObjects = MEMPOOL_SIZED_SLAB_SIZE / (objectSize + MEMPOOL_PER_OBJECT_OVERHEAD);
+        if (slabObjects < 8) {
+            slabObjects = 8;
+        }
+
+        if (0 != lpx_mempool_create_fixed_pool(&pool->classes[i], objectSize, slabObjects, 
+                                               isProtected | MEMPOOL_LAZY_INIT)) {
+            goto cleanup;
+        }
+
+        // Lock free pools cannot release slabs, so they keep what they grow.
+        if (0 != lpx_mempool_set_fixed_pool_growth(&pool->classes[i], slabObjects, 
+                                                   protection == MEMPOOL_LOCKFREE ? -1 : slabObjects)) {
+            lpx_mempool_destroy_fixed_pool(&pool->classes[i]);
+            goto cleanup;
+        }
+    }
+
+    pool->magic = MEMPOOL_SIZED_MAGIC;
+    return MEMPOOL_SUCCESS;
+
+cleanup:
+    while (--i >= 0) {
+        lpx_mempool_destroy_fixed_pool(&pool->classes[i]);
+    }
+    if (pool->hasLarge) {
+        lpx_mempool_destroy_variable_pool(&pool->large);
+    }
+    return MEMPOOL_FAILURE;
+}
+
+/**
+ * @brief  Allocate an object of any size from a sized pool.
+ * @param  pool The pool to allocate from.
+ * @param  size The size of the object.
+ * @return A valid address on success, NULL on failure.
+ */
+void *lpx_mempool_sized_alloc(lpx_mempool_sized_t *pool, long size)
+{
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SIZED_MAGIC || size < 0)) {
+        return NULL;
+    }
+
+    if (LIKELY(size <= MEMPOOL_SIZED_MAX_SMALL)) {
+        return lpx_mempool_fixed_alloc(&pool->classes[sizeClass(size)]);
+    }
+
+    if (!pool->hasLarge) {
+        return NULL;
+    }
+
+    return lpx_mempool_variable_alloc(&pool->large, size);
+}
+
+/**
+ * @brief  Free an object that was allocated from a sized pool.
+ * @param  pool The pool the object came from.
+ * @param  addr The address of the object.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_sized_free(lpx_mempool_sized_t *pool, void *addr)
+{
+    long header = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SIZED_MAGIC || addr == NULL)) {
+        return MEMPOOL_FAILURE;
+    }
+
+    // Objects of the size classes point back to their fixed pool, which sits inside this
+    // struct. Objects of the variable pool have their size there, which never looks like it.
+    header = ((long *)addr)[-1];
+    if (LIKELY(header >= (long)&pool->classes[0] && 
+               header < (long)&pool->classes[MEMPOOL_SIZED_CLASSES])) {
+        return lpx_mempool_fixed_free(addr);
+    }
+
+    return lpx_mempool_variable_free(addr);
+}
+
+/**
+ * @brief  Resize an object of a sized pool. It stays where it is if it still fits its
+ *         size class, and large objects are resized by their variable pool.
+ * @param  pool The pool the object came from.
+ * @param  addr The object to resize, NULL to allocate a new one.
+ * @param  size The new size of the object.
+ * @return The address of the resized object, NULL on failure, in which case the old
+ *         object is left untouched.
+ */
+void *lpx_mempool_sized_realloc(lpx_mempool_sized_t *pool, void *addr, long size)
+{
+    long header = 0;
+    long oldSize = 0;
+    void *newAddr = NULL;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SIZED_MAGIC || size < 0)) {
         return NULL;
     }
 
-    // Lock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_lock(pool->poolMutex)) {
-	    return NULL;
-	}
-	unlockNeeded = 1;
+    if (addr == NULL) {
+        return lpx_mempool_sized_alloc(pool, size);
+    }
+
+    header = ((long *)addr)[-1];
+    if (header >= (long)&pool->classes[0] && 
+        header < (long)&pool->classes[MEMPOOL_SIZED_CLASSES]) {
+        oldSize = sizeClassSize((lpx_mempool_fixed_t *)header - pool->classes);
+        if (size <= MEMPOOL_SIZED_MAX_SMALL && 
+            (lpx_mempool_fixed_t *)header == &pool->classes[sizeClass(size)]) {
+            return addr;
+        }
+    } else {
+        if (size > MEMPOOL_SIZED_MAX_SMALL) {
+            return lpx_mempool_variable_realloc(&pool->large, addr, size);
+        }
+        oldSize = (header & VPMD_SIZE_MASK) - MEMPOOL_PER_BLOCK_OVERHEAD;
+    }
+
+    // It moves between a size class and the variable pool, or to another class.
+    newAddr = lpx_mempool_sized_alloc(pool, size);
+    if (newAddr == NULL) {
+        return NULL;
     }
+    memcpy(newAddr, addr, oldSize < size ? oldSize : size);
+    lpx_mempool_sized_free(pool, addr);
 
-    // First off, adjust the size to accomodate the metadata.
-    size += MEMPOOL_PER_BLOCK_OVERHEAD;
-    if (size < 3 * sizeof(long)) {
-        // Because this should be linkable back into the list.
-	size += 3 * sizeof(long);
+    return newAddr;
+}
+
+/**
+ * @brief  Destroy a sized pool and all the pools behind it.
+ * @param  pool The pool to destroy.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_mempool_destroy_sized_pool(lpx_mempool_sized_t *pool)
+{
+    int i = 0;
+
+    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_SIZED_MAGIC)) {
+        return MEMPOOL_FAILURE;
     }
 
-    // Find the first fit block from the free list.
-    candidateBlock = findFirstFit(pool, size);
-    if (candidateBlock == NULL) {
-        if (unlockNeeded) {
-	    pthread_mutex_unlock(pool->poolMutex);
-	}
-        return NULL;
+    pool->magic = 0;
+    for (i = 0; i < MEMPOOL_SIZED_CLASSES; i++) {
+        lpx_mempool_destroy_fixed_pool(&pool->classes[i]);
     }
-    
-    // Split the block and re-link the free list.
-    candidateBlock = splitBlock(pool, candidateBlock, &size);
-    if (candidateBlock == NULL) {
-        if (unlockNeeded) {
-	    pthread_mutex_lock(pool->poolMutex);
-	}
-	return NULL;
+    if (pool->hasLarge) {
+        lpx_mempool_destroy_variable_pool(&pool->large);
     }
 
-    // Prep the block for return.
-    ((long *)candidateBlock)[0] = (long)pool;
-    ((long *)candidateBlock)[1] = size;
+    return MEMPOOL_SUCCESS;
+}
 
-    // Unlock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
-	    return NULL;
-	}
+/**
+ * @brief  Find the size class of a request. Classes are 16 bytes apart up to 128 bytes,
+ *         after that every doubling is split into four classes.
+ * @param  size The size of the request, at most MEMPOOL_SIZED_MAX_SMALL.
+ * @return The index of the smallest class that fits.
+ */
+static inline int sizeClass(long size)
+{
+    unsigned long last = size > 0 ? size - 1 : 0;
+    int msb = 0;
+
+    if (size <= 128) {
+        return (int)(last >> 4);
     }
 
-    // &candidateBlock[2] is the start of the user memory block.
-    return &(((long *)candidateBlock)[2]);
+    msb = 63 - __builtin_clzl(last);
+    return 8 + (msb - 7) * 4 + (int)((last >> (msb - 2)) & 3);
 }
 
 /**
- * @brief  Free an object that was allocated on variable sized memory pool.
- * @param  addr The address of the object to free.
- * @return 0 on success, -1 on failure.
+ * @brief  Find the object size of a size class.
+ * @param  sizeClass The index of the class.
+ * @return The largest request that the class serves.
  */
-int lpx_mempool_variable_free(void *addr)
+static long sizeClassSize(int sizeClass)
 {
-    lpx_mempool_variable_t *pool = NULL;
-    long size = 0;
-    long *originalBlock = (long *)addr;
+    int group = (sizeClass - 8) / 4;
 
-    if (UNLIKELY(addr == NULL)) {
-        return MEMPOOL_FAILURE;
+    if (sizeClass < 8) {
+        return 16L * (sizeClass + 1);
     }
 
-    // Find the pool that this block points to & the size of the block.
-    originalBlock -= 2;
-    pool = (lpx_mempool_variable_t *)originalBlock[0];
-    size = originalBlock[1];
-    if (pool->magic != MEMPOOL_VARIABLE_MAGIC) {
-        return MEMPOOL_FAILURE;
+    return (128L << group) + ((sizeClass - 8) % 4 + 1) * (32L << group);
+}
+
+/**
+ * @brief  Allocate the stats block of a pool created with MEMPOOL_STATS.
+ * @return The zeroed block on success, NULL on failure.
+ */
+static lpx_mempool_stats_block_t *createStats(void)
+{
+    lpx_mempool_stats_block_t *stats = NULL;
+
+    // Keep the slots on cache lines of their own.
+    if (0 != posix_memalign((void **)&stats, sizeof(lpx_mempool_stats_slot_t), 
+                            sizeof(lpx_mempool_stats_block_t))) {
+        return NULL;
     }
 
-    // Lock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_lock(pool->poolMutex)) {
-	    return MEMPOOL_FAILURE;
-	}
+    memset(stats, 0, sizeof(lpx_mempool_stats_block_t));
+    return stats;
+}
+
+/**
+ * @brief  Find the calling thread's slot of a stats block. Threads are dealt slots round
+ *         robin the first time they count anything.
+ * @param  stats The stats block.
+ * @return The slot.
+ */
+static inline lpx_mempool_stats_slot_t *statSlot(lpx_mempool_stats_block_t *stats)
+{
+    static int nextSlot = 0;
+    static __thread int slot = -1;
+
+    if (UNLIKELY(slot < 0)) {
+        slot = __sync_fetch_and_add(&nextSlot, 1) % MEMPOOL_STATS_SLOTS;
     }
 
-    // Add the block back into the free list.
-    originalBlock[VPMD_SIZE_OFFSET] = size;
-    insertIntoFreeList(pool, (void *)originalBlock);
+    return &stats->slots[slot];
+}
+
+/**
+ * @brief Add up the slots of a stats block.
+ * @param stats The stats block.
+ * @param snapshot Receives the totals. Live objects and bytes in use are derived from them.
+ */
+static void sumStats(lpx_mempool_stats_block_t *stats, lpx_mempool_stats_t *snapshot)
+{
+    volatile lpx_mempool_stats_slot_t *slot = NULL;
+    int i = 0;
 
-    // Unlock the mutex if needed.
-    if (pool->poolMutex != NULL) {
-        if (0 != pthread_mutex_unlock(pool->poolMutex)) {
-	    return MEMPOOL_FAILURE;
-	}
+    memset(snapshot, 0, sizeof(lpx_mempool_stats_t));
+    for (i = 0; i < MEMPOOL_STATS_SLOTS; i++) {
+        slot = &stats->slots[i];
+        snapshot->allocs += slot->allocs;
+        snapshot->frees += slot->frees;
+        snapshot->failedAllocs += slot->failedAllocs;
+        snapshot->contended += slot->contended;
+        snapshot->bytesInUse += slot->bytesAllocated - slot->bytesFreed;
     }
- 
-    return MEMPOOL_SUCCESS;
+    snapshot->liveObjects = snapshot->allocs - snapshot->frees;
 }
 
 /**
- * @brief  Release all the resources associated with this pool.
- * @param  pool The pool to destroy.
- * @return 0 on success, -1 on failure.
+ * @brief Raise the high water mark of a pool if a new level was reached.
+ * @param stats The stats block of the pool.
+ * @param level The number of objects that are out of the pool now.
  */
-int lpx_mempool_destroy_variable_pool(lpx_mempool_variable_t *pool)
+static inline void raiseHighWater(lpx_mempool_stats_block_t *stats, long level)
 {
-    if (UNLIKELY(pool == NULL || pool->magic != MEMPOOL_VARIABLE_MAGIC || pool->pool == NULL)) {
-        return MEMPOOL_FAILURE;
+    long highWaterMark = stats->highWaterMark;
+
+    while (level > highWaterMark && 
+           !__sync_bool_compare_and_swap(&stats->highWaterMark, highWaterMark, level)) {
+        highWaterMark = stats->highWaterMark;
     }
+}
 
-    /* Be safe and shoot off a call to munlock this address range. */
-    lpx_mempool_unpin_variable_pool(pool);
+/**
+ * @brief  Lock the mutex of a pool, counting it as contended if it was not free.
+ * @param  mutex The mutex of the pool.
+ * @param  stats The stats block of the pool, NULL if it keeps no stats.
+ * @return 0 on success, an error number on failure.
+ */
+static inline int lockPool(pthread_mutex_t *mutex, lpx_mempool_stats_block_t *stats)
+{
+    if (stats == NULL) {
+        return pthread_mutex_lock(mutex);
+    }
 
-    free(pool->pool);
-    
-    if (pool->poolMutex != NULL) {
-        pthread_mutex_destroy(pool->poolMutex);
-	free(pool->poolMutex);
+    if (0 == pthread_mutex_trylock(mutex)) {
+        return 0;
     }
 
-    return MEMPOOL_SUCCESS;
+    COUNT_STAT(stats, contended, 1);
+    return pthread_mutex_lock(mutex);
 }
 
 /**
- * @brief Find the first block in the free list that can satisfy the request.
+ * @brief Find a free block that can satisfy the request, from the TLSF index if the
+ *        pool has one, otherwise from the size bins. Growable pools grow if needed.
  * @param pool The pool to search.
  * @param size The size of block to search for.
- * @return The address of the first block that fits, NULL if no fit present.
+ * @return The address of a block that fits, NULL if no fit present.
  */
-static void *findFirstFit(lpx_mempool_variable_t *pool, long size)
+static long *findFit(lpx_mempool_variable_t *pool, long size)
 {
-    void *firstFit = NULL;
-    long *blockMetadata = NULL;
-    void *currentBlock = pool->freeList;
-
-    while (currentBlock != NULL) {
-        blockMetadata = (long *)currentBlock;
-	
-	// Does this block fit the request?
-	if (size <= blockMetadata[VPMD_SIZE_OFFSET]) {
-	    firstFit = currentBlock;
-	    break;
-	}
+    long *block = NULL;
+
+    if (size < 0) {
+        return NULL;
+    }
 
-	currentBlock = (void *)blockMetadata[VPMD_NEXT_OFFSET];
+    if (size <= pool->capacity) {
+        block = pool->tlsf != NULL ? tlsfFind(pool->tlsf, size) : binFind(pool, size);
     }
 
-    return firstFit;
+    // Growable pools map another extent, which always fits.
+    if (block == NULL && pool->extentSize != 0 && 0 == growVariablePool(pool, size)) {
+        block = pool->tlsf != NULL ? tlsfFind(pool->tlsf, size) : binFind(pool, size);
+    }
+
+    return block;
 }
 
 /**
- * @brief Split the block and put the remainder back into the list.
+ * @brief Take a free block out of the index and give the tail that is not needed
+ *        back as a free block of its own.
  * @param pool The pool that this block belongs to.
- * @param addr The address of the block to split.
- * @param requestSize The desired size of block to retrieve.
+ * @param block The free block to split.
+ * @param requestSize The desired size of block to retrieve, updated if the whole
+ *                    block is handed out.
  * @return The address of the allocated block to return to the caller.
  */
-static void *splitBlock(lpx_mempool_variable_t *pool, void *addr, long *requestSize)
+static void *splitBlock(lpx_mempool_variable_t *pool, long *block, long *requestSize)
 {
-    void *allocatedBlock = NULL;
-    long *blockMetadata= (long *)addr;
-    long blockSize = blockMetadata[VPMD_SIZE_OFFSET];
-    long *prevBlock = NULL;
-    long *nextBlock = NULL;
+    long blockSize = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
     long size = *requestSize;
+    long *next = NULL;
+
+    indexRemove(pool, block);
 
-    // Ensure that the remaining block has space atleast one allocation, 
+    // Ensure that the remaining block can be linked back into the index, 
     // if not, just send it along with allocated data block.
-    if ((blockSize - size) < (4 * sizeof(long))) {
+    if ((blockSize - size) >= VPMD_MIN_BLOCK_SIZE) {
+        // The block after the tail still sees a free block before it.
+        next = (long *)((char *)block + size);
+        next[0] = (long)pool;
+        tagFreeBlock(next, blockSize - size);
+        indexInsert(pool, next);
+    } else {
         size = blockSize;
+        next = (long *)((char *)block + size);
+        next[VPMD_TAG_OFFSET] &= ~VPMD_PREV_FREE;
     }
 
-    if (blockSize == size) {
-        // Unlink the block.
-	allocatedBlock = addr;
-        prevBlock = (long *)blockMetadata[VPMD_PREV_OFFSET];
-        nextBlock = (long *)blockMetadata[VPMD_NEXT_OFFSET];
-
-	if (prevBlock != NULL) {
-	    // Current block is not the head of the list.
-	    
-	    // Point the prev block's next pointer to the current block's next.
-	    prevBlock[VPMD_NEXT_OFFSET] = (long)nextBlock;
-
-	    // If the current block is not the tail of the list, make its next
-	    // blocks backpointer point its prev block.
-	    if (nextBlock != NULL) {
-	        nextBlock[VPMD_PREV_OFFSET] = (long)prevBlock;
-	    }
-	} else {
-	    // Current block is the head of the list.
-
-	    // Point the free list head pointer to the next block.
-	    pool->freeList = (void *)nextBlock;
-	    
-	    // If the current block is not the tail of the list null out the prev
-	    // pointer of the next block.
-	    if (nextBlock != NULL) {
-	        nextBlock[VPMD_PREV_OFFSET] = 0;
-	    }
-	}
-    } else {
-        // Just reduce the size of the block.
-	blockMetadata[VPMD_SIZE_OFFSET] = blockSize - size;
-	allocatedBlock = (void *)((long)addr + (blockSize - size));
-    }
+    // Free blocks never follow each other, so nothing before this one is free.
+    block[VPMD_TAG_OFFSET] = size;
 
     // Update the size of the requested block just in case we grew it.
     *requestSize = size;
-    return allocatedBlock;
+    return block;
 }
 
-
 /**
- * @brief Insert a block back into the free list, which is ordered by address.
- * @param pool The pool to add the block to.
- * @param addr The address to add into the free list.
+ * @brief Merge a block with whichever of its physical neighbours are free and put the
+ *        result back into the index. The tags make this constant time, no matter how
+ *        many free blocks there are.
+ * @param pool The pool the block belongs to.
+ * @param block The block to free.
  */
-static void insertIntoFreeList(lpx_mempool_variable_t *pool, void *addr)
+static void freeBlock(lpx_mempool_variable_t *pool, long *block)
 {
-    long *listHead = (long *)pool->freeList;
-    long *node = (long *)pool->freeList;
+    long size = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+    long *next = (long *)((char *)block + size);
     long *prev = NULL;
-    long *current = (long *)addr;
-    long *next = NULL;
-    int insertAfterInstead = 0;
 
-    if (listHead == NULL) {
-        // Simple case, this block is the new head.
-	current[VPMD_NEXT_OFFSET] = 0;
-	listHead = current;
+    // Every region ends in an allocated block, so there always is a next one.
+    if (next[VPMD_TAG_OFFSET] & VPMD_BLOCK_FREE) {
+        indexRemove(pool, next);
+        size += next[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+    } else {
+        next[VPMD_TAG_OFFSET] |= VPMD_PREV_FREE;
+    }
+
+    if (block[VPMD_TAG_OFFSET] & VPMD_PREV_FREE) {
+        // The last word of the free block before this one holds its size.
+        prev = (long *)((char *)block - block[-1]);
+        indexRemove(pool, prev);
+        size += block[-1];
+        block = prev;
+    }
+
+    tagFreeBlock(block, size);
+    indexInsert(pool, block);
+}
+
+/**
+ * @brief Put a free block into the TLSF index or the size bins.
+ * @param pool The pool the block belongs to.
+ * @param block The block, with its tag set.
+ */
+static void indexInsert(lpx_mempool_variable_t *pool, long *block)
+{
+    if (pool->tlsf != NULL) {
+        tlsfInsert(pool->tlsf, block);
+    } else {
+        binInsert(pool, block);
+    }
+}
+
+/**
+ * @brief Take a free block out of the TLSF index or the size bins.
+ * @param pool The pool the block belongs to.
+ * @param block The block.
+ */
+static void indexRemove(lpx_mempool_variable_t *pool, long *block)
+{
+    if (pool->tlsf != NULL) {
+        tlsfRemove(pool->tlsf, block);
     } else {
-        // Block needs to be inserted into the list.
-	listHead = (listHead > current) ? current : listHead;
-	
-	// First, find the node that it needs to be inserted before.
-	node = listHead;
-        while (node < current) {
-	   // Make sure we dont run off the end of the list.
-	   if (node[VPMD_NEXT_OFFSET] == 0) {
-	       insertAfterInstead = 1;
-	       break;
-	   }
-           // Keep traversing otherwise.
-	   node = (long *)(node[VPMD_NEXT_OFFSET]);
-        }
-
-	// Now actually insert the node before or after the node.
-	if (insertAfterInstead) {
-	    insertAfter(node, current);
-	} else {
-	    insertBefore(node, current);
+        binRemove(pool, block);
+    }
+}
+
+/**
+ * @brief Find a free block in the size bins. The bins are looked up through the
+ *        bitmap, so this takes constant time unless the only fit left is somewhere
+ *        in the bin of the request itself.
+ * @param pool The pool to search.
+ * @param size The size of block to search for.
+ * @return The address of a block that fits, NULL if no fit present.
+ */
+static long *binFind(lpx_mempool_variable_t *pool, long size)
+{
+    int bin = binIndex(size);
+    long *block = (long *)pool->bins[bin];
+    unsigned long larger = 0;
+
+    // The head of the bin of the request is close in size, take it if it is large enough.
+    if (block != NULL && size <= (block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK)) {
+        return block;
+    }
+
+    // Every block in a higher bin fits, so take one from the lowest of them.
+    if (bin + 1 < MEMPOOL_VARIABLE_BINS) {
+        larger = pool->binMap & (~0UL << (bin + 1));
+    }
+    if (larger != 0) {
+        return pool->bins[__builtin_ctzl(larger)];
+    }
+
+    // The rest of the bin of the request is all that is left.
+    while (block != NULL) {
+	if (size <= (block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK)) {
+	    return block;
 	}
+	block = (long *)block[VPMD_LINK_NEXT_OFFSET];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Call a function on every free list of a variable pool that is not empty. The
+ *        bitmaps of the bins or the TLSF index say which ones are worth visiting.
+ * @param pool The pool, locked.
+ * @param visit The function, called with the first block of a list and arg.
+ * @param arg Passed on to the function.
+ */
+static void visitFreeLists(lpx_mempool_variable_t *pool, void (*visit)(long *, void *), 
+                           void *arg)
+{
+    unsigned long flMap = 0;
+    unsigned long binMap = 0;
+    unsigned int slMap = 0;
+    int fl = 0;
+
+    if (pool->tlsf != NULL) {
+        for (flMap = pool->tlsf->flMap; flMap != 0; flMap &= flMap - 1) {
+            fl = __builtin_ctzl(flMap);
+            for (slMap = pool->tlsf->slMap[fl]; slMap != 0; slMap &= slMap - 1) {
+                visit(pool->tlsf->lists[fl][__builtin_ctz(slMap)], arg);
+            }
+        }
+    } else {
+        for (binMap = pool->binMap; binMap != 0; binMap &= binMap - 1) {
+            visit(pool->bins[__builtin_ctzl(binMap)], arg);
+        }
     }
+}
 
-    // If the head of the list has changed, update the free list pointer.
-    if (pool->freeList != listHead) {
-       pool->freeList = (void *)listHead;
-       listHead[VPMD_PREV_OFFSET] = 0;
+/**
+ * @brief Add the blocks of one free list to a fragmentation report.
+ * @param block The first block of the list.
+ * @param arg The report.
+ */
+static void countFreeBlocks(long *block, void *arg)
+{
+    lpx_mempool_frag_t *frag = (lpx_mempool_frag_t *)arg;
+    long size = 0;
+
+    for (; block != NULL; block = (long *)block[VPMD_LINK_NEXT_OFFSET]) {
+        size = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+        frag->freeBytes += size;
+        frag->freeBlocks++;
+        frag->histogram[63 - __builtin_clzl(size)]++;
+        if (size > frag->largestFree) {
+            frag->largestFree = size;
+        }
     }
+}
 
-    // Finally, call coalesce to minimize fragmentation.
-    prev = (long *)current[VPMD_PREV_OFFSET];
-    next = (long *)current[VPMD_NEXT_OFFSET];
-    coalesceBlocks(prev, current, next);
+/**
+ * @brief Drop the pages inside the large blocks of one free list. The words that link
+ *        and tag a block stay, so only whole pages between them go.
+ * @param block The first block of the list.
+ * @param arg Points to the smallest block size worth purging.
+ */
+static void purgeFreeBlocks(long *block, void *arg)
+{
+    long minSize = *(long *)arg;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long size = 0;
+    char *start = NULL;
+    char *end = NULL;
 
-    return;
+    for (; block != NULL; block = (long *)block[VPMD_LINK_NEXT_OFFSET]) {
+        size = block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK;
+        if (size < minSize) {
+            continue;
+        }
+        start = (char *)ALIGN_UP((unsigned long)&block[VPMD_LINK_PREV_OFFSET + 1], pageSize);
+        end = (char *)(((unsigned long)block + size - sizeof(long)) & ~(pageSize - 1));
+        if (end > start) {
+            madvise(start, end - start, MADV_DONTNEED);
+        }
+    }
 }
 
 /**
- * @brief Insert one block after another.
- * @param prev The block to insert after.
- * @param blockToInsert The block to insert.
+ * @brief  Find the arena of a pool that the calling thread allocates from. Threads are
+ *         numbered round robin the first time they ask, the same number picks the arena
+ *         of every pool.
+ * @param  pool A pool with arenas.
+ * @return The arena.
  */
-static void insertAfter(long *prev, long *blockToInsert)
+static inline lpx_mempool_variable_t *threadArena(lpx_mempool_variable_t *pool)
 {
-    long *next = (long *)prev[VPMD_NEXT_OFFSET];
+    static unsigned int nextThread = 0;
+    static __thread unsigned int thread = 0;
+    unsigned int arena = 0;
 
-    prev[VPMD_NEXT_OFFSET] = (long)blockToInsert;
-    blockToInsert[VPMD_PREV_OFFSET] = (long)prev;
+    // Zero means the thread has no number yet.
+    if (UNLIKELY(thread == 0)) {
+        thread = __sync_add_and_fetch(&nextThread, 1);
+    }
 
-    blockToInsert[VPMD_NEXT_OFFSET] = (long)next;
-    if (next != NULL) {
-        next[VPMD_PREV_OFFSET] = (long)blockToInsert;
+    arena = (thread - 1) % pool->numArenas;
+    return arena == 0 ? pool : &pool->arenas[arena - 1];
+}
+
+/**
+ * @brief  Check whether a pool is one of the arenas of another.
+ * @param  pool The pool, with or without arenas.
+ * @param  arena The pool to look for.
+ * @return 1 if it is the pool itself or one of its arenas, 0 otherwise.
+ */
+static inline int isArenaOf(lpx_mempool_variable_t *pool, lpx_mempool_variable_t *arena)
+{
+    return arena == pool || (pool->arenas != NULL && arena >= pool->arenas && 
+                             arena < pool->arenas + (pool->numArenas - 1));
+}
+
+/**
+ * @brief Turn a region of memory into one free block followed by the allocated block
+ *        that ends the region, and add it to the pool.
+ * @param pool The pool the region belongs to.
+ * @param start The start of the region.
+ * @param size The size of the region.
+ */
+static void initRegion(lpx_mempool_variable_t *pool, long *start, long size)
+{
+    long *end = (long *)((char *)start + size - VPMD_END_SIZE);
+
+    end[0] = (long)pool;
+    end[VPMD_TAG_OFFSET] = VPMD_END_SIZE | VPMD_PREV_FREE;
+    start[0] = (long)pool;
+    tagFreeBlock(start, size - VPMD_END_SIZE);
+    indexInsert(pool, start);
+    pool->capacity += size - VPMD_END_SIZE;
+}
+
+/**
+ * @brief Map another extent for a growable variable pool.
+ * @param pool The pool, locked.
+ * @param size The size of the block that did not fit.
+ * @return 0 on success, -1 if the pool may not grow that far or the mapping failed.
+ */
+static int growVariablePool(lpx_mempool_variable_t *pool, long size)
+{
+    lpx_mempool_variable_extent_t *extent = NULL;
+    long extentSize = pool->extentSize;
+
+    // A request larger than an extent gets an extent of its own.
+    if (size > extentSize - (long)sizeof(lpx_mempool_variable_extent_t) - VPMD_END_SIZE) {
+        extentSize = size + sizeof(lpx_mempool_variable_extent_t) + VPMD_END_SIZE;
+    }
+    extentSize = mappedSize(extentSize, pool->flags);
+
+    if (pool->maxSize != 0 && pool->capacity + extentSize > pool->maxSize) {
+        return MEMPOOL_FAILURE;
+    }
+
+    extent = (lpx_mempool_variable_extent_t *)mapPoolMemory(extentSize, pool->flags);
+    if (extent == NULL) {
+        return MEMPOOL_FAILURE;
+    }
+
+    if (pool->flags & MEMPOOL_PINNED) {
+        mlock(extent, extentSize);
     }
 
-    return;
+    extent->size = extentSize;
+    extent->next = pool->extents;
+    pool->extents = extent;
+    initRegion(pool, (long *)(extent + 1), extentSize - sizeof(lpx_mempool_variable_extent_t));
+
+    return MEMPOOL_SUCCESS;
 }
 
 /**
- * @brief Insert a block before the specified one.
- * @param after The block to insert before.
- * @param blockToInsert The block to insert.
+ * @brief  Work out which bin a free block of the given size belongs in.
+ * @param  size The size of the block, at least VPMD_MIN_BLOCK_SIZE.
+ * @return The index of the bin.
  */
-static void insertBefore(long *after, long *blockToInsert)
+static inline int binIndex(long size)
 {
-    long *prev = (long *)after[VPMD_PREV_OFFSET];
+    int log = 63 - __builtin_clzl(size);
+    int bin = (log - 5) * 4 + (int)((size >> (log - 2)) & 3);
+
+    return bin < MEMPOOL_VARIABLE_BINS ? bin : MEMPOOL_VARIABLE_BINS - 1;
+}
 
-    prev[VPMD_NEXT_OFFSET] = (long)blockToInsert;
-    blockToInsert[VPMD_PREV_OFFSET] = (long)prev;
+/**
+ * @brief Push a free block onto the front of its bin.
+ * @param pool The pool the block belongs to.
+ * @param block The block to insert.
+ */
+static void binInsert(lpx_mempool_variable_t *pool, long *block)
+{
+    int bin = binIndex((block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK));
+    long *head = (long *)pool->bins[bin];
 
-    after[VPMD_PREV_OFFSET] = (long)blockToInsert;
-    blockToInsert[VPMD_NEXT_OFFSET] = (long)after;
-    return;
+    block[VPMD_LINK_PREV_OFFSET] = 0;
+    block[VPMD_LINK_NEXT_OFFSET] = (long)head;
+    if (head != NULL) {
+        head[VPMD_LINK_PREV_OFFSET] = (long)block;
+    }
+    pool->bins[bin] = block;
+    pool->binMap |= 1UL << bin;
 }
 
 /**
- * @brief Coalesce the free list into larger blocks.
- * @param prev The previous block in the free list.
- * @param current The block to coalesce.
- * @param next The next block in the free list.
+ * @brief Take a free block out of its bin.
+ * @param pool The pool the block belongs to.
+ * @param block The block to remove.
  */
-static void coalesceBlocks(long *prev, long *current, long *next)
+static void binRemove(lpx_mempool_variable_t *pool, long *block)
 {
+    int bin = binIndex((block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK));
+    long *prev = (long *)block[VPMD_LINK_PREV_OFFSET];
+    long *next = (long *)block[VPMD_LINK_NEXT_OFFSET];
+
     if (next != NULL) {
-        coalesce(current, next); 
+        next[VPMD_LINK_PREV_OFFSET] = (long)prev;
     }
-
     if (prev != NULL) {
-        coalesce(prev, current);
+        prev[VPMD_LINK_NEXT_OFFSET] = (long)next;
+    } else {
+        pool->bins[bin] = next;
+        if (next == NULL) {
+            pool->binMap &= ~(1UL << bin);
+        }
+    }
+}
+
+/**
+ * @brief Find a free block in the TLSF index that fits the request. The request is
+ *        rounded up to the next list first, so the head of the list found is taken
+ *        without looking at its size. Only if there is none, the head of the list of
+ *        the request itself is tried.
+ * @param tlsf The index to search.
+ * @param size The size of block needed.
+ * @return The block, NULL if none fits.
+ */
+static long *tlsfFind(lpx_mempool_tlsf_t *tlsf, long size)
+{
+    unsigned long flMap = 0;
+    unsigned int slMap = 0;
+    long rounded = size;
+    long *block = NULL;
+    int fl = 0;
+    int sl = 0;
+
+    if (size >= (1L << (MEMPOOL_TLSF_SL_LOG + 3))) {
+        rounded += (1L << (63 - __builtin_clzl(size) - MEMPOOL_TLSF_SL_LOG)) - 1;
+    }
+    tlsfMapping(rounded, &fl, &sl);
+
+    slMap = tlsf->slMap[fl] & (~0U << sl);
+    if (slMap == 0) {
+        if (fl + 1 < MEMPOOL_TLSF_FL) {
+            flMap = tlsf->flMap & (~0UL << (fl + 1));
+        }
+        if (flMap != 0) {
+            fl = __builtin_ctzl(flMap);
+            slMap = tlsf->slMap[fl];
+        }
+    }
+    if (slMap != 0) {
+        return (long *)tlsf->lists[fl][__builtin_ctz(slMap)];
+    }
+
+    tlsfMapping(size, &fl, &sl);
+    block = (long *)tlsf->lists[fl][sl];
+    if (block != NULL && size <= (block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK)) {
+        return block;
     }
 
-    return;
+    return NULL;
 }
 
 /**
- * @brief Coalesce this block with the next one.
- * @param current The block to coalesce.
- * @param next The block to coalesce with.
+ * @brief Work out which TLSF list a free block of the given size belongs in.
+ * @param size The size of the block.
+ * @param fl Receives the first level class.
+ * @param sl Receives the list within the class.
  */
-static void coalesce(long *current, long *next)
+static inline void tlsfMapping(long size, int *fl, int *sl)
 {
-    unsigned long currentAddr = (long)current;
-    unsigned long nextAddr = (long)next;
-    long *nextNext = (long *)next[VPMD_NEXT_OFFSET];
+    int log = 0;
 
-    if (currentAddr + current[VPMD_SIZE_OFFSET] == nextAddr) {
-        // First, adjust the size.
-        current[VPMD_SIZE_OFFSET] += next[VPMD_SIZE_OFFSET];
+    if (size < (1L << (MEMPOOL_TLSF_SL_LOG + 3))) {
+        *fl = 0;
+        *sl = (int)(size >> 3);
+        return;
+    }
 
-	// Next, adjust the links.
-	current[VPMD_NEXT_OFFSET] = (long)nextNext;
-	if (nextNext != NULL) {
-	    nextNext[VPMD_PREV_OFFSET] = (long)current;
-	}
+    log = 63 - __builtin_clzl(size);
+    *fl = log - (MEMPOOL_TLSF_SL_LOG + 3) + 1;
+    *sl = (int)(size >> (log - MEMPOOL_TLSF_SL_LOG)) - MEMPOOL_TLSF_SL;
+}
+
+/**
+ * @brief Push a free block onto the front of its TLSF list.
+ * @param tlsf The index of the pool.
+ * @param block The block to insert, with its tag set.
+ */
+static void tlsfInsert(lpx_mempool_tlsf_t *tlsf, long *block)
+{
+    int fl = 0;
+    int sl = 0;
+    long *head = NULL;
+
+    tlsfMapping(block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK, &fl, &sl);
+    head = (long *)tlsf->lists[fl][sl];
+    block[VPMD_LINK_PREV_OFFSET] = 0;
+    block[VPMD_LINK_NEXT_OFFSET] = (long)head;
+    if (head != NULL) {
+        head[VPMD_LINK_PREV_OFFSET] = (long)block;
+    }
+    tlsf->lists[fl][sl] = block;
+    tlsf->slMap[fl] |= 1U << sl;
+    tlsf->flMap |= 1UL << fl;
+}
+
+/**
+ * @brief Take a free block out of its TLSF list.
+ * @param tlsf The index of the pool.
+ * @param block The block to remove.
+ */
+static void tlsfRemove(lpx_mempool_tlsf_t *tlsf, long *block)
+{
+    int fl = 0;
+    int sl = 0;
+    long *prev = (long *)block[VPMD_LINK_PREV_OFFSET];
+    long *next = (long *)block[VPMD_LINK_NEXT_OFFSET];
+
+    if (next != NULL) {
+        next[VPMD_LINK_PREV_OFFSET] = (long)prev;
+    }
+    if (prev != NULL) {
+        prev[VPMD_LINK_NEXT_OFFSET] = (long)next;
+        return;
     }
 
-    return;
+    tlsfMapping(block[VPMD_TAG_OFFSET] & VPMD_SIZE_MASK, &fl, &sl);
+    tlsf->lists[fl][sl] = next;
+    if (next == NULL) {
+        tlsf->slMap[fl] &= ~(1U << sl);
+        if (tlsf->slMap[fl] == 0) {
+            tlsf->flMap &= ~(1UL << fl);
+        }
+    }
 }
 
+/**
+ * @brief Tag a block as free and copy its size into its last word for the block after it.
+ * @param block The block.
+ * @param size The size of the block.
+ */
+static inline void tagFreeBlock(long *block, long size)
+{
+    block[VPMD_TAG_OFFSET] = size | VPMD_BLOCK_FREE;
+    block[size / sizeof(long) - 1] = size;
+}
@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include "asmopt.h"
 
 /**
@@ -54,6 +55,114 @@
  */
 #define MEMPOOL_UNPROTECTED		3	
 
+/**
+ * @def MEMPOOL_LOCKFREE
+ * @brief Specifies that the fixed pool should be thread safe without a mutex. The free
+ *        list is updated with compare and swap instead. Not valid for variable pools.
+ */
+#define MEMPOOL_LOCKFREE		4
+
+/**
+ * @def   MEMPOOL_PROTECTION_MASK
+ * @brief Extracts the protection mode from the flags passed in at creation time.
+ */
+#define MEMPOOL_PROTECTION_MASK		0xff
+
+/**
+ * @def   MEMPOOL_THREAD_CACHE
+ * @brief Creation flag for fixed pools. Or this with MEMPOOL_PROTECTED to give every
+ *        thread a small cache of free objects that it can allocate from and free into
+ *        without taking the pool mutex. Each such pool holds one of the process wide
+ *        pthread keys (PTHREAD_KEYS_MAX) until it is destroyed.
+ */
+#define MEMPOOL_THREAD_CACHE		0x100
+
+/**
+ * @def   MEMPOOL_HUGEPAGES
+ * @brief Creation flag. Back the pool with huge pages, using reserved huge pages
+ *        (MAP_HUGETLB) when there are any and transparent huge pages otherwise.
+ */
+#define MEMPOOL_HUGEPAGES		0x200
+
+/**
+ * @def   MEMPOOL_POPULATE
+ * @brief Creation flag. Fault in all the memory of the pool when it is created.
+ */
+#define MEMPOOL_POPULATE		0x400
+
+/**
+ * @def   MEMPOOL_LAZY_INIT
+ * @brief Creation flag for fixed pools. Create the pool in constant time and hand out
+ *        never used objects from a bump pointer, so pages are only touched once needed.
+ */
+#define MEMPOOL_LAZY_INIT		0x800
+
+/**
+ * @def   MEMPOOL_STATS
+ * @brief Creation flag. Keep usage counters for the pool, see lpx_mempool_fixed_get_stats
+ *        and lpx_mempool_variable_get_stats.
+ */
+#define MEMPOOL_STATS			0x1000
+
+/**
+ * @def   MEMPOOL_TLSF
+ * @brief Creation flag for variable pools. Index the free blocks two level segregated
+ *        fit style, so that allocating takes constant time even in the worst case.
+ */
+#define MEMPOOL_TLSF			0x2000
+
+/**
+ * @def   MEMPOOL_FRAG_BUCKETS
+ * @brief Number of buckets in the free block histogram of a variable pool, one per
+ *        power of two.
+ */
+#define MEMPOOL_FRAG_BUCKETS		64
+
+/**
+ * @def   MEMPOOL_TLSF_SL_LOG
+ * @brief Log2 of the number of second level lists per power of two in a TLSF pool.
+ */
+#define MEMPOOL_TLSF_SL_LOG		4
+
+/**
+ * @def   MEMPOOL_TLSF_SL
+ * @brief Number of second level lists per power of two in a TLSF pool.
+ */
+#define MEMPOOL_TLSF_SL			(1 << MEMPOOL_TLSF_SL_LOG)
+
+/**
+ * @def   MEMPOOL_TLSF_FL
+ * @brief Number of first level classes in a TLSF pool. The first one holds the blocks
+ *        below 128 bytes in steps of 8, the others one power of two each.
+ */
+#define MEMPOOL_TLSF_FL			58
+
+/**
+ * @def   MEMPOOL_STATS_SLOTS
+ * @brief The number of counter slots of a pool with MEMPOOL_STATS. Threads count into
+ *        their own slot so that they rarely share a cache line with each other.
+ */
+#define MEMPOOL_STATS_SLOTS		16
+
+/**
+ * @def   MEMPOOL_HUGE_PAGE_SIZE
+ * @brief Size of a huge page. Huge page backed pools are rounded up to a multiple of this.
+ */
+#define MEMPOOL_HUGE_PAGE_SIZE		(2L * 1024L * 1024L)
+
+/**
+ * @def   MEMPOOL_THREAD_CACHE_SIZE
+ * @brief The number of free objects a thread may cache before it flushes them
+ *        back to the pool.
+ */
+#define MEMPOOL_THREAD_CACHE_SIZE	32
+
+/**
+ * @def   MEMPOOL_THREAD_CACHE_BATCH
+ * @brief The number of objects a thread pulls from the pool when its cache runs dry.
+ */
+#define MEMPOOL_THREAD_CACHE_BATCH	(MEMPOOL_THREAD_CACHE_SIZE / 2)
+
 /**
  * @def   MEMPOOL_FIXED_MAGIC
  * @brief Magic number to verify the integrity of a fixed pool.
@@ -65,12 +174,68 @@
  */
 #define MEMPOOL_VARIABLE_MAGIC		0xc0ffee12
 
+/**
+ * @def   MEMPOOL_NUMA_MAGIC
+ * @brief Magic number to verify the integrity of a NUMA pool.
+ */
+#define MEMPOOL_NUMA_MAGIC		0xbeef5ca1
+
+/**
+ * @def   MEMPOOL_SHARED_MAGIC
+ * @brief Magic number to verify the integrity of a shared pool.
+ */
+#define MEMPOOL_SHARED_MAGIC		0x5ca1ab1e
+
+/**
+ * @def   MEMPOOL_SHARED_NAME_SIZE
+ * @brief The longest shared memory name a shared pool remembers, terminator included.
+ */
+#define MEMPOOL_SHARED_NAME_SIZE	256
+
+/**
+ * @def   MEMPOOL_SIZED_MAGIC
+ * @brief Magic number to verify the integrity of a sized pool.
+ */
+#define MEMPOOL_SIZED_MAGIC		0x51fed00d
+
+/**
+ * @def   MEMPOOL_SIZED_CLASSES
+ * @brief The number of size classes of a sized pool: steps of 16 bytes up to 128,
+ *        then four steps per doubling up to MEMPOOL_SIZED_MAX_SMALL.
+ */
+#define MEMPOOL_SIZED_CLASSES		28
+
+/**
+ * @def   MEMPOOL_SIZED_MAX_SMALL
+ * @brief The largest request a sized pool serves from its size classes.
+ */
+#define MEMPOOL_SIZED_MAX_SMALL		4096
+
+/**
+ * @def   MEMPOOL_SIZED_SLAB_SIZE
+ * @brief Roughly how many bytes a size class of a sized pool adds at a time.
+ */
+#define MEMPOOL_SIZED_SLAB_SIZE		(32L * 1024L)
+
+/**
+ * @def   MEMPOOL_NUMA_MAX_NODES
+ * @brief The largest number of NUMA nodes that a NUMA pool keeps sub-pools for.
+ */
+#define MEMPOOL_NUMA_MAX_NODES		64
+
 /**
  * @def   MEMPOOL_PER_OBJECT_OVERHEAD
  * @brief How much memory is needed for metadata for each object in a fixed pool.
  */
 #define MEMPOOL_PER_OBJECT_OVERHEAD	(sizeof (void *))
 
+/**
+ * @def   MEMPOOL_ALIGNED_SLAB_SIZE
+ * @brief Size and alignment of the slabs of aligned fixed pools. Objects of such pools
+ *        find their pool by masking their address with this.
+ */
+#define MEMPOOL_ALIGNED_SLAB_SIZE	(64L * 1024L)
+
 /**
  * @def   MEMPOOL_PER_BLOCK_OVERHEAD	
  * @brief How much memory is needed for metadata for each block in a variable pool.
@@ -78,22 +243,148 @@
 #define MEMPOOL_PER_BLOCK_OVERHEAD	(2 * sizeof(long))
 
 /**
- * @def   VPMD_SIZE_OFFSET 
- * @brief Offset of the size in the free list block.
+ * @def   VPMD_MIN_BLOCK_SIZE
+ * @brief The smallest block a variable pool hands out, so that it can be linked back
+ *        into its size bin and still has room for its size at the end.
+ */
+#define VPMD_MIN_BLOCK_SIZE	(5 * sizeof(long))
+
+/**
+ * @def   VPMD_END_SIZE
+ * @brief Size of the allocated block that ends every region of a variable pool, so
+ *        that the block before it never has to check where its region ends.
+ */
+#define VPMD_END_SIZE		MEMPOOL_PER_BLOCK_OVERHEAD
+
+/**
+ * @def   MEMPOOL_VARIABLE_BINS
+ * @brief Number of size bins of a variable pool, four per power of two from 32 bytes.
+ *        The last one also takes every block of 2MB and up.
+ */
+#define MEMPOOL_VARIABLE_BINS	64
+
+/**
+ * @def   VPMD_TAG_OFFSET
+ * @brief Offset of the size and state bits in the header of a block of a variable pool,
+ *        the pool itself is at offset 0. Free blocks repeat their size in their last
+ *        word, so the block after them can find them.
+ */
+#define VPMD_TAG_OFFSET		1
+
+/**
+ * @def   VPMD_LINK_NEXT_OFFSET
+ * @brief Offset of the next pointer of a free block in its bin or TLSF list.
+ */
+#define VPMD_LINK_NEXT_OFFSET	2
+
+/**
+ * @def   VPMD_LINK_PREV_OFFSET
+ * @brief Offset of the previous pointer of a free block in its bin or TLSF list.
+ */
+#define VPMD_LINK_PREV_OFFSET	3
+
+/**
+ * @def   VPMD_BLOCK_FREE
+ * @brief Tag bit set while the block is free.
+ */
+#define VPMD_BLOCK_FREE		0x1L
+
+/**
+ * @def   VPMD_PREV_FREE
+ * @brief Tag bit set while the block just before this one is free.
+ */
+#define VPMD_PREV_FREE		0x2L
+
+/**
+ * @def   VPMD_SIZE_MASK
+ * @brief Masks the state bits off a tag.
+ */
+#define VPMD_SIZE_MASK		(~7L)
+
+struct __mempool_fixed_t;
+
+/**
+ * @brief A per thread cache of free objects for a fixed pool. Only the owning thread
+ *        pushes and pops objects, other threads may only steal the whole chain while
+ *        holding the pool mutex.
+ */
+typedef struct __mempool_fixed_cache_t {
+    void *objects;				/**< Chain of cached free objects. */
+    int count;					/**< Number of objects in the chain. */
+    struct __mempool_fixed_t *pool;		/**< The pool this cache belongs to. */
+    struct __mempool_fixed_cache_t *next;	/**< Next cache of the pool. */
+    struct __mempool_fixed_cache_t *prev;	/**< Previous cache of the pool. */
+}lpx_mempool_fixed_cache_t;
+
+/**
+ * @brief A slab of objects that a growable fixed pool added on demand. The objects
+ *        follow the slab header directly.
  */
-#define VPMD_SIZE_OFFSET	0
+typedef struct __mempool_fixed_slab_t {
+    struct __mempool_fixed_t *pool;		/**< The pool this slab belongs to. */
+    struct __mempool_fixed_slab_t *next;	/**< The next slab of the pool. */
+    long size;					/**< Size of the slab including this header. */
+    long numObjects;				/**< Number of objects in the slab. */
+    long freeCount;				/**< Scratch space used while trimming. */
+}lpx_mempool_fixed_slab_t;
 
 /**
- * @def   VPMD_PREV_OFFSET
- * @brief Offset of the previous pointer in the free list block.
+ * @brief A snapshot of the counters of a pool, filled in by lpx_mempool_fixed_get_stats
+ *        and lpx_mempool_variable_get_stats.
  */
-#define VPMD_PREV_OFFSET	1
+typedef struct __mempool_stats_t {
+    long liveObjects;			/**< Objects allocated and not freed yet. */
+    long highWaterMark;			/**< The most objects that were out of the pool at once. */
+    long allocs;			/**< Successful allocations. */
+    long frees;				/**< Successful frees. */
+    long failedAllocs;			/**< Allocations that failed because the pool ran out. */
+    long bytesInUse;			/**< Bytes handed out and not freed yet, headers included. */
+    long capacity;			/**< Objects the pool holds right now, bytes for variable pools. */
+    long contended;			/**< Times the pool mutex was busy and a caller had to block. */
+} lpx_mempool_stats_t;
 
 /**
- * @def   VPMD_NEXT_OFFSET
- * @brief Index of the next pointer in the free list block.
+ * @brief How the free memory of a variable pool is split up, filled in by
+ *        lpx_mempool_variable_get_fragmentation. A pool whose largest free block is
+ *        much smaller than its free bytes is fragmented rather than full.
  */
-#define VPMD_NEXT_OFFSET	2
+typedef struct __mempool_frag_t {
+    long freeBytes;			/**< Bytes in free blocks, headers included. */
+    long largestFree;			/**< The size of the largest free block. */
+    long freeBlocks;			/**< The number of free blocks. */
+    long histogram[MEMPOOL_FRAG_BUCKETS];/**< Free blocks of 2^i up to 2^(i+1) - 1 bytes in [i]. */
+} lpx_mempool_frag_t;
+
+/**
+ * @brief The counters that one slot of a stats block keeps.
+ */
+typedef struct __mempool_stats_slot_t {
+    long allocs;			/**< Successful allocations. */
+    long frees;				/**< Successful frees. */
+    long failedAllocs;			/**< Failed allocations. */
+    long contended;			/**< Blocking mutex acquisitions. */
+    long bytesAllocated;		/**< Bytes allocated, variable pools only. */
+    long bytesFreed;			/**< Bytes freed, variable pools only. */
+} __attribute__((aligned(64))) lpx_mempool_stats_slot_t;
+
+/**
+ * @brief The counters of a pool created with MEMPOOL_STATS. Slots are summed up when the
+ *        stats are read.
+ */
+typedef struct __mempool_stats_block_t {
+    lpx_mempool_stats_slot_t slots[MEMPOOL_STATS_SLOTS]; /**< Counters, one slot per thread. */
+    long highWaterMark;			/**< The most objects that were out of the pool at once. */
+    long liveObjects;			/**< Live objects of variable pools, kept under the mutex. */
+} lpx_mempool_stats_block_t;
+
+/**
+ * @brief The head of a lock free list. The tag changes on every update so a compare
+ *        and swap on both words fails if the head was popped and pushed back meanwhile.
+ */
+typedef struct __mempool_tagged_head_t {
+    void *head;				/**< The first object in the list. */
+    unsigned long tag;			/**< Generation count of the head. */
+} __attribute__((aligned(16))) lpx_mempool_tagged_head_t;
 
 /**
  * @brief A struct to represent a memory pool of fixed sized objects.
@@ -102,31 +393,129 @@ typedef struct __mempool_fixed_t {
     pthread_mutex_t *poolMutex;		/**< A mutex to protect the pool if needed. */
     void *pool;				/**< The actual memory pool. */
     void *freeList;			/**< List of free nodes. */
+    lpx_mempool_tagged_head_t lockFreeList; /**< List of free nodes of lock free pools. */
+    char *bumpNext;			/**< Next never used object of a lazily initialized pool. */
+    char *bumpEnd;			/**< End of the never used objects. */
     long poolSize;			/**< Size of the actual memory pool. */
     long storedObjectSize;		/**< Object size + overhead */
+    long headerSize;			/**< Bytes in front of each object, 0 for aligned pools. */
+    long alignment;			/**< Alignment of the objects. */
+    long slabSize;			/**< Size and alignment of slabs, 0 for unaligned slabs. */
+    int flags;				/**< Protection mode and creation flags. */
+    pthread_key_t cacheKey;		/**< Finds the calling thread's cache if caching. */
+    lpx_mempool_fixed_cache_t *caches;	/**< All the thread caches of this pool. */
+    lpx_mempool_fixed_slab_t *slabs;	/**< Slabs added to the pool since creation. */
+    int slabObjects;			/**< Objects per new slab, 0 if the pool cannot grow. */
+    long numObjects;			/**< Objects in the pool, slabs included. */
+    long lowWaterMark;			/**< Free objects to keep when releasing slabs, -1 to keep all. */
+    long freeCount;			/**< Free and never used objects, unused if lock free. */
+    long trimThreshold;			/**< Free count at which free slabs are released. */
+    lpx_mempool_stats_block_t *stats;	/**< Usage counters, NULL unless MEMPOOL_STATS. */
     int magic;				/**< Enables a simple integrity check. */
 }lpx_mempool_fixed_t;
 
+/**
+ * @brief A struct to represent a fixed pool that is split into one sub-pool per NUMA node.
+ *        Every sub-pool is placed on its node, and objects are allocated from the sub-pool of
+ *        the node the caller is running on. Objects are freed with lpx_mempool_fixed_free,
+ *        which returns them to the sub-pool they came from.
+ */
+typedef struct __mempool_numa_t {
+    lpx_mempool_fixed_t *nodePools;	/**< One fixed pool per node, indexed by node. */
+    int numNodes;			/**< The number of nodes, and of sub-pools. */
+    int magic;				/**< Enables a simple integrity check. */
+}lpx_mempool_numa_t;
+
 
 /*
- * Structure of the free list.
- *                                 |----------------------------+
- *             +---------------+   +-----+----+----+    +-----+-+--+----+
- * freeList--->|blkSz|NULL|next+-->|blkSz|prev|next+--> |blkSz|prev|NULL|
- *             +-----+----+----+   +-----+-+--+----+    +-----+----+----+
- *             |---------------------------+
+ * Structure of the blocks of a variable pool.
+ *
+ *             allocated block                        free block
+ *  +----+-----------+-------------+    +----+--------------+----+----+-----+----+
+ *  |pool|size|flags | user data.. |    |pool|size|FREE|.. |next|prev| ... |size|
+ *  +----+-----------+-------------+    +----+--------------+-+--+-+--+-----+----+
+ *                                                            |    |
+ *                                   next/prev free block <---+----+
+ *                                   in the same bin or TLSF list
  *
- * > Each node is sizeof(long) + sizeof(long) + sizeof(long).
+ * > The tag holds the size of the block and the VPMD_BLOCK_FREE and VPMD_PREV_FREE
+ *   bits. A free block repeats its size in its last word, so the block after it
+ *   can find its start when the two are merged.
+ * > Free blocks are linked into one of MEMPOOL_VARIABLE_BINS size bins, or into a
+ *   TLSF list when the pool was created with MEMPOOL_TLSF.
+ * > Every region ends in an allocated block of VPMD_END_SIZE bytes.
  */
 
 /**
- * @brief A struct to represent a memory pool of variable sized objects.
+ * @brief The state of a shared pool. It sits at the start of the shared block and refers
+ *        to objects by their offset from it, so every process can map the block anywhere.
+ *        Free objects are linked through their header, allocated ones keep their own
+ *        offset there.
+ */
+typedef struct __mempool_shared_header_t {
+    pthread_mutex_t mutex;		/**< A process shared, robust mutex. */
+    long storedObjectSize;		/**< Object size + overhead. */
+    long numObjects;			/**< The number of objects in the pool. */
+    long size;				/**< The size of the block. */
+    long freeList;			/**< Offset of the first free object, 0 if there is none. */
+    long bumpNext;			/**< Offset of the first never used object. */
+    long bumpEnd;			/**< Offset of the end of the objects. */
+    long freeCount;			/**< Free and never used objects. */
+    int magic;				/**< Enables a simple integrity check. */
+}lpx_mempool_shared_header_t;
+
+/**
+ * @brief A process's handle on a fixed pool that lives in shared memory. Objects are
+ *        passed between processes as offsets, see lpx_mempool_shared_offset and
+ *        lpx_mempool_shared_address.
+ */
+typedef struct __mempool_shared_t {
+    lpx_mempool_shared_header_t *header; /**< The start of the shared block in this process. */
+    long mappedSize;			/**< Size of the mapping made by the library, 0 if none. */
+    char name[MEMPOOL_SHARED_NAME_SIZE]; /**< The shared memory object, empty if none. */
+    int magic;				/**< Enables a simple integrity check. */
+}lpx_mempool_shared_t;
+
+/**
+ * @brief The free block index of a variable pool created with MEMPOOL_TLSF. A bit in
+ *        flMap says that the first level class has a non-empty list, and a bit in its
+ *        slMap says which.
+ */
+typedef struct __mempool_tlsf_t {
+    unsigned long flMap;			/**< Bit i is set while slMap[i] is not 0. */
+    unsigned int slMap[MEMPOOL_TLSF_FL];	/**< Bit j is set while lists[i][j] is not empty. */
+    void *lists[MEMPOOL_TLSF_FL][MEMPOOL_TLSF_SL];/**< The lists of free blocks. */
+}lpx_mempool_tlsf_t;
+
+/**
+ * @brief An extent that a growable variable pool mapped on demand. Its blocks follow
+ *        the header directly.
+ */
+typedef struct __mempool_variable_extent_t {
+    struct __mempool_variable_extent_t *next;	/**< The next extent of the pool. */
+    long size;					/**< Size of the mapping including this header. */
+}lpx_mempool_variable_extent_t;
+
+/**
+ * @brief A struct to represent a memory pool of variable sized objects. A pool created
+ *        with arenas is split into independent sub-pools with a mutex each, so threads
+ *        allocating from it do not all queue up on one lock.
  */
 typedef struct __mempool_variable_t {
     pthread_mutex_t *poolMutex;		/**< A mutex to protect the pool if needed. */
     void *pool;				/**< The actual memory pool. */
     long poolSize;			/**< The size of the actual pool. */
-    void *freeList;			/**< List of free blocks. */
+    void *bins[MEMPOOL_VARIABLE_BINS];	/**< The free blocks, segregated by size. */
+    unsigned long binMap;		/**< Bit i is set while bins[i] is not empty. */
+    lpx_mempool_tlsf_t *tlsf;		/**< Index of the free blocks, NULL unless MEMPOOL_TLSF. */
+    lpx_mempool_variable_extent_t *extents;/**< Extents mapped since the pool was created. */
+    long extentSize;			/**< Size of a new extent, 0 if the pool cannot grow. */
+    long maxSize;			/**< The most the capacity may grow to, 0 for no limit. */
+    long capacity;			/**< Bytes the blocks of all regions take up together. */
+    int flags;				/**< Protection mode and creation flags. */
+    lpx_mempool_stats_block_t *stats;	/**< Usage counters, NULL unless MEMPOOL_STATS. */
+    struct __mempool_variable_t *arenas;/**< The arenas besides this pool, NULL if there are none. */
+    int numArenas;			/**< The number of arenas, this pool included. */
     int magic;				/**< Enables a simple integrity check. */
 }lpx_mempool_variable_t;
 
@@ -140,18 +529,72 @@ int lpx_mempool_create_fixed_pool_from_block(lpx_mempool_fixed_t *pool,
                                              void *base);
 void *lpx_mempool_fixed_alloc(lpx_mempool_fixed_t *pool);
 int lpx_mempool_fixed_free(void *addr);
+int lpx_mempool_create_aligned_fixed_pool(lpx_mempool_fixed_t *pool, long objectSize,
+                                          long alignment, int numObjects, int isProtected);
+int lpx_mempool_aligned_free(void *addr);
+int lpx_mempool_fixed_alloc_bulk(lpx_mempool_fixed_t *pool, void **out, int n);
+int lpx_mempool_fixed_free_bulk(void **objs, int n);
+int lpx_mempool_set_fixed_pool_growth(lpx_mempool_fixed_t *pool, int slabObjects,
+                                      long lowWaterMark);
 int lpx_mempool_destroy_fixed_pool(lpx_mempool_fixed_t *pool);
 int lpx_mempool_pin_fixed_pool(lpx_mempool_fixed_t *pool);
 int lpx_mempool_unpin_fixed_pool(lpx_mempool_fixed_t *pool);
+int lpx_mempool_fixed_get_stats(lpx_mempool_fixed_t *pool, lpx_mempool_stats_t *stats);
+
+int lpx_mempool_create_numa_pool(lpx_mempool_numa_t *pool, long objectSize,
+                                 int numObjectsPerNode, int isProtected);
+void *lpx_mempool_numa_alloc(lpx_mempool_numa_t *pool);
+int lpx_mempool_destroy_numa_pool(lpx_mempool_numa_t *pool);
+
+long lpx_mempool_shared_pool_size(long objectSize, int numObjects);
+int lpx_mempool_create_shared_pool(lpx_mempool_shared_t *pool, const char *name,
+                                   long objectSize, int numObjects);
+int lpx_mempool_create_shared_pool_from_block(lpx_mempool_shared_t *pool, long objectSize,
+                                              int numObjects, long size, void *base);
+int lpx_mempool_open_shared_pool(lpx_mempool_shared_t *pool, const char *name);
+int lpx_mempool_attach_shared_pool(lpx_mempool_shared_t *pool, void *base);
+void *lpx_mempool_shared_alloc(lpx_mempool_shared_t *pool);
+int lpx_mempool_shared_free(lpx_mempool_shared_t *pool, void *addr);
+long lpx_mempool_shared_offset(lpx_mempool_shared_t *pool, void *addr);
+void *lpx_mempool_shared_address(lpx_mempool_shared_t *pool, long offset);
+int lpx_mempool_close_shared_pool(lpx_mempool_shared_t *pool);
+int lpx_mempool_destroy_shared_pool(lpx_mempool_shared_t *pool);
+
+/**
+ * @brief A general purpose pool that serves small requests from a ladder of growable
+ *        fixed pools, one per size class, and larger ones from a variable pool.
+ */
+typedef struct __mempool_sized_t {
+    lpx_mempool_fixed_t classes[MEMPOOL_SIZED_CLASSES]; /**< One fixed pool per size class. */
+    lpx_mempool_variable_t large;	/**< Serves requests above MEMPOOL_SIZED_MAX_SMALL. */
+    int hasLarge;			/**< Was the large pool created? */
+    int magic;				/**< Enables a simple integrity check. */
+}lpx_mempool_sized_t;
 
 int lpx_mempool_create_variable_pool(lpx_mempool_variable_t *pool, long, int);
+int lpx_mempool_create_variable_pool_with_arenas(lpx_mempool_variable_t *pool, long size,
+                                                int isProtected, int numArenas);
 int lpx_mempool_create_variable_pool_from_block(lpx_mempool_variable_t *pool, 
                                                 long size, int isProtected, 
                                                 void *base);
 void *lpx_mempool_variable_alloc(lpx_mempool_variable_t *pool, long size);
 int lpx_mempool_variable_free(void *addr);
+void *lpx_mempool_variable_realloc(lpx_mempool_variable_t *pool, void *addr, long size);
+void *lpx_mempool_variable_memalign(lpx_mempool_variable_t *pool, long alignment, long size);
 int lpx_mempool_destroy_variable_pool(lpx_mempool_variable_t *pool);
 int lpx_mempool_pin_variable_pool(lpx_mempool_variable_t *pool);
 int lpx_mempool_unpin_variable_pool(lpx_mempool_variable_t *pool);
+int lpx_mempool_variable_get_stats(lpx_mempool_variable_t *pool, lpx_mempool_stats_t *stats);
+int lpx_mempool_variable_get_fragmentation(lpx_mempool_variable_t *pool, 
+                                           lpx_mempool_frag_t *frag);
+int lpx_mempool_set_variable_pool_growth(lpx_mempool_variable_t *pool, long extentSize,
+                                         long maxSize);
+int lpx_mempool_purge_variable_pool(lpx_mempool_variable_t *pool, long minSize);
+
+int lpx_mempool_create_sized_pool(lpx_mempool_sized_t *pool, long largeSize, int isProtected);
+void *lpx_mempool_sized_alloc(lpx_mempool_sized_t *pool, long size);
+int lpx_mempool_sized_free(lpx_mempool_sized_t *pool, void *addr);
+void *lpx_mempool_sized_realloc(lpx_mempool_sized_t *pool, void *addr, long size);
+int lpx_mempool_destroy_sized_pool(lpx_mempool_sized_t *pool);
 
 #endif
@@ -40,13 +40,13 @@ int lpx_pcq_init(lpx_pcq_t *queue, int queueDepth)
 
     // The nqSem is decremented every time someone wants to put something on the
     // queue so it should be initially available, which is the default.
-    if (0 != lpx_sem_init(&queue->nqSem, queueDepth)) {
+    if (0 != lpx_sem_init_adaptive(&queue->nqSem, queueDepth)) {
         return PCQ_FAILURE;
     }
 
     // The dqSem is decremented every time someone wants to pull something off the
     // queue so it should be initially completely unavailable.
-    if (0 != lpx_sem_init(&queue->dqSem, queueDepth)) {
+    if (0 != lpx_sem_init_adaptive(&queue->dqSem, queueDepth)) {
         goto pcq_destroy1;
     }
  
@@ -151,6 +151,27 @@ int lpx_pcq_dequeue(lpx_pcq_t *queue, void **data)
  * @return 0 on success, -1 on failure.
  */
 int lpx_pcq_timed_enqueue(lpx_pcq_t *queue, void *data, long timeout)
+{
+    struct timespec deadline;
+
+    if (timeout <= 0) {
+        return PCQ_FAILURE;
+    }
+
+    deadline = lpx_deadline_after(timeout);
+    return lpx_pcq_enqueue_until(queue, data, &deadline);
+}
+
+/**
+ * @brief  Enqueue an item into the queue, waiting for space until a deadline at
+ *         most. Like with lpx_pcq_timed_enqueue, the deadline only applies to the
+ *         wait for space.
+ * @param  queue The queue to operate on.
+ * @param  data  Pointer to the data to insert.
+ * @param  deadline When to give up, on CLOCK_MONOTONIC, see lpx_deadline_after.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+int lpx_pcq_enqueue_until(lpx_pcq_t *queue, void *data, const struct timespec *deadline)
 {
     int retval = 0;
 
@@ -159,7 +180,7 @@ int lpx_pcq_timed_enqueue(lpx_pcq_t *queue, void *data, long timeout)
     }
 
     // Decrement the nqSem first to ensure there is space available.
-    if ((retval = lpx_sem_timed_down(&queue->nqSem, 1, timeout)) != 0) {
+    if ((retval = lpx_sem_down_until(&queue->nqSem, 1, deadline)) != 0) {
         if (retval == SEMAPHORE_TIMEOUT) {
 	    return PCQ_TIMEOUT;
 	} else {
@@ -193,6 +214,27 @@ int lpx_pcq_timed_enqueue(lpx_pcq_t *queue, void *data, long timeout)
  * @return 0 on success, -1 on failure.
  */
 int lpx_pcq_timed_dequeue(lpx_pcq_t *queue, void **data, long timeout)
+{
+    struct timespec deadline;
+
+    if (timeout <= 0) {
+        return PCQ_FAILURE;
+    }
+
+    deadline = lpx_deadline_after(timeout);
+    return lpx_pcq_dequeue_until(queue, data, &deadline);
+}
+
+/**
+ * @brief  Dequeue an item from the queue, waiting for one until a deadline at most.
+ *         Like with lpx_pcq_timed_dequeue, the deadline only applies to the wait
+ *         for an item.
+ * @param  queue The queue to operate on.
+ * @param  data  An output pointer to set to the dequeued data.
+ * @param  deadline When to give up, on CLOCK_MONOTONIC, see lpx_deadline_after.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+int lpx_pcq_dequeue_until(lpx_pcq_t *queue, void **data, const struct timespec *deadline)
 {
     int retval = 0;
 
@@ -201,7 +243,7 @@ int lpx_pcq_timed_dequeue(lpx_pcq_t *queue, void **data, long timeout)
     }
 
     // Decrement the dqSem to ensure there is something to dequeue.
-    if ((retval = lpx_sem_timed_down(&queue->dqSem, 1, timeout)) != 0) {
+    if ((retval = lpx_sem_down_until(&queue->dqSem, 1, deadline)) != 0) {
         if (retval == SEMAPHORE_TIMEOUT) {
 	    return PCQ_TIMEOUT;
 	} else {
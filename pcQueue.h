@@ -71,6 +71,8 @@ int lpx_pcq_enqueue(lpx_pcq_t *queue, void *data);
 int lpx_pcq_dequeue(lpx_pcq_t *queue, void **data);
 int lpx_pcq_timed_enqueue(lpx_pcq_t *queue, void *data, long timeout);
 int lpx_pcq_timed_dequeue(lpx_pcq_t *queue, void **data, long timeout);
+int lpx_pcq_enqueue_until(lpx_pcq_t *queue, void *data, const struct timespec *deadline);
+int lpx_pcq_dequeue_until(lpx_pcq_t *queue, void **data, const struct timespec *deadline);
 int lpx_pcq_destroy(lpx_pcq_t *queue);
 
 #endif
@@ -19,9 +19,9 @@
  */
 
 #include "rwlock.h"
+#include "sem.h"
 
-static struct timespec timeoutToTimespec(long);
-extern long timespecDiffMillis(struct timespec greater, struct timespec lesser);
+static void spinForLock(lpx_rwlock_t *, int);
 
 /**
  * @brief Initialize the reader writer lock.
@@ -30,6 +30,8 @@ extern long timespecDiffMillis(struct timespec greater, struct timespec lesser);
  */
 int lpx_rwlock_init(lpx_rwlock_t *rwlock)
 {
+    pthread_condattr_t attr;
+
     if (UNLIKELY(rwlock == NULL)) {
         return RWLOCK_ERROR;
     }
@@ -38,11 +40,39 @@ int lpx_rwlock_init(lpx_rwlock_t *rwlock)
         return RWLOCK_ERROR;
     }
 
-    if (pthread_cond_init(&rwlock->rwlock_cvar, NULL) != 0) {
+    // Timed waits use deadlines on the monotonic clock, which the wall clock cannot move.
+    if (pthread_condattr_init(&attr) != 0) {
+        return RWLOCK_ERROR;
+    }
+    if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&rwlock->rwlock_cvar, &attr) != 0) {
+        pthread_condattr_destroy(&attr);
         return RWLOCK_ERROR;
     }
+    pthread_condattr_destroy(&attr);
 
     rwlock->value = 0;
+    rwlock->spins = -1;
+
+    return RWLOCK_SUCCESS;
+}
+
+/**
+ * @brief Initialize a reader writer lock that spins for a while before it blocks,
+ *        for locks that are only held briefly. The spin is tuned to how long recent
+ *        acquisitions had to wait, and skipped on a single CPU.
+ * @param rwlock The reader writer lock to operate on.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_rwlock_init_adaptive(lpx_rwlock_t *rwlock)
+{
+    if (0 != lpx_rwlock_init(rwlock)) {
+        return RWLOCK_ERROR;
+    }
+
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        rwlock->spins = 0;
+    }
 
     return RWLOCK_SUCCESS;
 }
@@ -78,6 +108,10 @@ int lpx_rwlock_acquire_reader_lock(lpx_rwlock_t *rwlock)
         return RWLOCK_ERROR;
     }
 
+    if (rwlock->spins >= 0) {
+        spinForLock(rwlock, 0);
+    }
+
     // Grab the mutex.
     if (pthread_mutex_lock(&rwlock->rwlock_mutex) != 0) {
         return RWLOCK_ERROR;
@@ -110,66 +144,56 @@ int lpx_rwlock_acquire_reader_lock(lpx_rwlock_t *rwlock)
  *        if the lock could not be acquired before the timeout expires.
  * @param rwlock The reader writer lock to operate on.
  * @param timeoutMillis The timeout in milliseconds.
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, -1 on failure, -2 on timeout.
  */
 int lpx_rwlock_acquire_reader_lock_timed(lpx_rwlock_t *rwlock, long timeoutMillis)
 {
-    struct timespec timeout;
-    struct timespec before;
-    struct timespec after;
-    int retval = 0;
+    struct timespec deadline;
 
-    if (UNLIKELY(rwlock == NULL)) {
+    if (timeoutMillis <= 0) {
         return RWLOCK_ERROR;
     }
 
-    if (timeoutMillis <= 0) {
+    deadline = lpx_deadline_after(timeoutMillis);
+    return lpx_rwlock_acquire_reader_lock_until(rwlock, &deadline);
+}
+
+/**
+ * @brief Increment the reader count. Will block if writers hold the lock, but not
+ *        past a deadline on CLOCK_MONOTONIC.
+ * @param rwlock The reader writer lock to operate on.
+ * @param deadline When to give up, see lpx_deadline_after.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+int lpx_rwlock_acquire_reader_lock_until(lpx_rwlock_t *rwlock, const struct timespec *deadline)
+{
+    int retval = 0;
+
+    if (UNLIKELY(rwlock == NULL || deadline == NULL)) {
         return RWLOCK_ERROR;
-    } else {
-        timeout = timeoutToTimespec(timeoutMillis);
     }
 
-    // Grab the mutex with a maximum of the specified timeout.
-    clock_gettime(CLOCK_REALTIME, &before);
-    if ((retval = pthread_mutex_timedlock(&rwlock->rwlock_mutex, &timeout)) != 0) {
-        if (retval == ETIMEDOUT) {
-            return RWLOCK_TIMEOUT;
-        } else {
-            return RWLOCK_ERROR;
-        }
+    if (rwlock->spins >= 0) {
+        spinForLock(rwlock, 0);
     }
-    clock_gettime(CLOCK_REALTIME, &after);
 
-    // We measured how long that operation took. Now readjust the timeout
-    // such that it holds the remaining time.
-    timeoutMillis -= timespecDiffMillis(after, before);
-    if (timeoutMillis < 0) {
-        pthread_mutex_unlock(&rwlock->rwlock_mutex);
-        return RWLOCK_TIMEOUT;
+    // The mutex is only ever held briefly, so it is not worth a deadline of its own.
+    if (pthread_mutex_lock(&rwlock->rwlock_mutex) != 0) {
+        return RWLOCK_ERROR;
     }
 
     while (rwlock->value < 0) {
-        timeout = timeoutToTimespec(timeoutMillis);
-        clock_gettime(CLOCK_REALTIME, &before);
         retval = pthread_cond_timedwait(&rwlock->rwlock_cvar, \
-	                                &rwlock->rwlock_mutex, &timeout);
-        
-        clock_gettime(CLOCK_REALTIME, &after);
-        timeoutMillis -= timespecDiffMillis(after, before);
-        
-        // Cvar wait timed out or failed.
-        if (retval == ETIMEDOUT) {
+	                                &rwlock->rwlock_mutex, deadline);
+
+        // A writer may have left just as the wait timed out.
+        if (retval == ETIMEDOUT && rwlock->value < 0) {
            pthread_mutex_unlock(&rwlock->rwlock_mutex);
            return RWLOCK_TIMEOUT;
-        } else if (retval != 0) {
+        } else if (retval != 0 && retval != ETIMEDOUT) {
+           pthread_mutex_unlock(&rwlock->rwlock_mutex);
            return RWLOCK_ERROR;
         }
-
-        // Cvar wait succeeded but we dont have any more time left. Too bad.
-        if (timeoutMillis <= 0) {
-            pthread_mutex_unlock(&rwlock->rwlock_mutex);
-            return RWLOCK_TIMEOUT;
-        }
     }
 
     // We have the mutex 
@@ -231,6 +255,10 @@ int lpx_rwlock_acquire_writer_lock(lpx_rwlock_t *rwlock)
         return RWLOCK_ERROR;
     }
 
+    if (rwlock->spins >= 0) {
+        spinForLock(rwlock, 1);
+    }
+
     // Grab the mutex.
     if (pthread_mutex_lock(&rwlock->rwlock_mutex) != 0) {
         return RWLOCK_ERROR;
@@ -263,66 +291,56 @@ int lpx_rwlock_acquire_writer_lock(lpx_rwlock_t *rwlock)
  *        the lock could be acquired.
  * @param rwlock The reader writer lock to operate on.
  * @param timeoutMillis The timeout in milliseconds.
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, -1 on failure, -2 on timeout.
  */
 int lpx_rwlock_acquire_writer_lock_timed(lpx_rwlock_t *rwlock, long timeoutMillis)
 {
-    struct timespec timeout;
-    struct timespec before;
-    struct timespec after;
-    int retval = 0;
+    struct timespec deadline;
 
-    if (UNLIKELY(rwlock == NULL)) {
+    if (timeoutMillis <= 0) {
         return RWLOCK_ERROR;
     }
 
-    if (timeoutMillis <= 0) {
+    deadline = lpx_deadline_after(timeoutMillis);
+    return lpx_rwlock_acquire_writer_lock_until(rwlock, &deadline);
+}
+
+/**
+ * @brief Increment the writer count and stop other readers and writers from acquiring
+ *        the lock. Fail out if a deadline on CLOCK_MONOTONIC passes first.
+ * @param rwlock The reader writer lock to operate on.
+ * @param deadline When to give up, see lpx_deadline_after.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+int lpx_rwlock_acquire_writer_lock_until(lpx_rwlock_t *rwlock, const struct timespec *deadline)
+{
+    int retval = 0;
+
+    if (UNLIKELY(rwlock == NULL || deadline == NULL)) {
         return RWLOCK_ERROR;
-    } else {
-        timeout = timeoutToTimespec(timeoutMillis);
     }
 
-    // Grab the mutex with a maximum of the specified timeout.
-    clock_gettime(CLOCK_REALTIME, &before);
-    if ((retval = pthread_mutex_timedlock(&rwlock->rwlock_mutex, &timeout)) != 0) {
-        if (retval == ETIMEDOUT) {
-            return RWLOCK_TIMEOUT;
-        } else {
-            return RWLOCK_ERROR;
-        }
+    if (rwlock->spins >= 0) {
+        spinForLock(rwlock, 1);
     }
-    clock_gettime(CLOCK_REALTIME, &after);
 
-    // We measured how long that operation took. Now readjust the timeout
-    // such that it holds the remaining time.
-    timeoutMillis -= timespecDiffMillis(after, before);
-    if (timeoutMillis < 0) {
-        pthread_mutex_unlock(&rwlock->rwlock_mutex);
-        return RWLOCK_TIMEOUT;
+    // The mutex is only ever held briefly, so it is not worth a deadline of its own.
+    if (pthread_mutex_lock(&rwlock->rwlock_mutex) != 0) {
+        return RWLOCK_ERROR;
     }
 
     while (rwlock->value != 0) {
-        timeout = timeoutToTimespec(timeoutMillis);
-        clock_gettime(CLOCK_REALTIME, &before);
         retval = pthread_cond_timedwait(&rwlock->rwlock_cvar, \
-	                                &rwlock->rwlock_mutex, &timeout);
-        
-        clock_gettime(CLOCK_REALTIME, &after);
-        timeoutMillis -= timespecDiffMillis(after, before);
-        
-        // Cvar wait timed out or failed.
-        if (retval == ETIMEDOUT) {
+	                                &rwlock->rwlock_mutex, deadline);
+
+        // The lock may have been released just as the wait timed out.
+        if (retval == ETIMEDOUT && rwlock->value != 0) {
            pthread_mutex_unlock(&rwlock->rwlock_mutex);
            return RWLOCK_TIMEOUT;
-        } else if (retval != 0) {
+        } else if (retval != 0 && retval != ETIMEDOUT) {
+           pthread_mutex_unlock(&rwlock->rwlock_mutex);
            return RWLOCK_ERROR;
         }
-
-        // Cvar wait succeeded but we dont have any more time left. Too bad.
-        if (timeoutMillis <= 0) {
-            pthread_mutex_unlock(&rwlock->rwlock_mutex);
-            return RWLOCK_TIMEOUT;
-        }
     }
 
     // We have the mutex, the value 0 is the only value that we can
@@ -371,30 +389,31 @@ int lpx_rwlock_release_writer_lock(lpx_rwlock_t *rwlock)
 }
 
 /**
- * @brief  Helper method to convert a timout value in milliseconds to a 
- *         struct timespec that is in absolute time.
- * @param  timeoutMillis Time in milliseconds.
- * @return The same value represented in a struct timespec as absolute time.
+ * @brief Spin until a lock looks free or the spin runs out, so that a lock released
+ *        soon is taken without sleeping on the condition variable. The bound is twice
+ *        the running average of past spins plus a little, like glibc does for its
+ *        adaptive mutexes. The caller still takes the lock the usual way afterwards.
+ * @param rwlock An adaptive reader writer lock.
+ * @param writer 1 to wait until nobody holds the lock, 0 until no writer does.
  */
-static struct timespec timeoutToTimespec(long timeoutMillis)
+static void spinForLock(lpx_rwlock_t *rwlock, int writer)
 {
-    struct timespec time;
-    long timeoutSec = 0;
-    long timeoutNanos = 0;
-     
-    memset(&time, 0, sizeof(struct timespec));
-    timeoutSec = timeoutMillis / 1000;
-    timeoutMillis -= (timeoutSec * 1000);
-    timeoutNanos = timeoutMillis * 1000 * 1000;
-
-    clock_gettime(CLOCK_REALTIME, &time);
-    time.tv_sec += timeoutSec;
-    time.tv_nsec += timeoutNanos;
-    if (time.tv_nsec > 1024 * 1024 * 1024) {
-        time.tv_nsec %= (1024 * 1024 * 1024);
-        time.tv_sec++;
-    }
-
-    return time;
+    int maxSpins = rwlock->spins * 2 + 10;
+    int spins = 0;
+
+    // Leave the estimate alone when there is nothing to wait for.
+    if (writer ? rwlock->value == 0 : rwlock->value >= 0) {
+        return;
+    }
+
+    if (maxSpins > RWLOCK_MAX_SPINS) {
+        maxSpins = RWLOCK_MAX_SPINS;
+    }
+
+    while (spins < maxSpins && (writer ? rwlock->value != 0 : rwlock->value < 0)) {
+        CPU_PAUSE();
+        spins++;
+    }
+    rwlock->spins += (spins - rwlock->spins) / 8;
 }
 
@@ -24,6 +24,7 @@
 #include <pthread.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include "asmopt.h"
 
 /**
@@ -45,24 +46,35 @@
 #define RWLOCK_TIMEOUT		-2
 
 /**
- * @brief
+ * @def   RWLOCK_MAX_SPINS
+ * @brief The most an adaptive lock spins before it waits on the condition variable.
+ */
+#define RWLOCK_MAX_SPINS	100
+
+/**
+ * @brief A reader writer lock. Adaptive locks spin for a while before they block,
+ *        for locks that are only held briefly.
  */
 typedef struct __lpx_rwlock_t {
-    int value;                      /**< Keeps track of the readers and writers. */
+    volatile int value;             /**< Keeps track of the readers and writers. */
+    int spins;                      /**< How long an adaptive lock spins, -1 if it never does. */
     pthread_mutex_t rwlock_mutex;   /**< The mutex part of the reader writer lock. */
     pthread_cond_t  rwlock_cvar;    /**< The condition variable part of the reader writer lock. */
 } lpx_rwlock_t;
     
 
 int lpx_rwlock_init(lpx_rwlock_t *rwlock);
+int lpx_rwlock_init_adaptive(lpx_rwlock_t *rwlock);
 int lpx_rwlock_destroy(lpx_rwlock_t *rwlock);
 
 int lpx_rwlock_acquire_reader_lock(lpx_rwlock_t *rwlock);
 int lpx_rwlock_acquire_reader_lock_timed(lpx_rwlock_t *rwlock, long timeoutMillis);
+int lpx_rwlock_acquire_reader_lock_until(lpx_rwlock_t *rwlock, const struct timespec *deadline);
 int lpx_rwlock_release_reader_lock(lpx_rwlock_t *rwlock);
 
 int lpx_rwlock_acquire_writer_lock(lpx_rwlock_t *rwlock);
 int lpx_rwlock_acquire_writer_lock_timed(lpx_rwlock_t *rwlock, long timeoutMillis);
+int lpx_rwlock_acquire_writer_lock_until(lpx_rwlock_t *rwlock, const struct timespec *deadline);
 int lpx_rwlock_release_writer_lock(lpx_rwlock_t *rwlock);
 
 #endif
@@ -1,8 +1,11 @@
 /**
  * @file   sem.c
  * @author Rakesh Iyer
- * @brief  A semaphore implementation that is built around pthread mutexes and
- *         condition variables. Supposedly better than a posix semaphore.
+ * @brief  A semaphore implementation that is built around an atomic counter and
+ *         Linux futexes. Ups and downs that do not have to wait are a single atomic
+ *         operation, the kernel is only entered to sleep and to wake sleepers.
+ *         Pollable semaphores are an eventfd in semaphore mode instead, so they
+ *         can be waited on together with sockets.
  * @bug    Not tested for performance.
  *
  * This program is free software: you can redistribute it and/or modify
@@ -19,10 +22,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include "sem.h"
 
 /* Forward declarations of utility functions. */
-static struct timespec timeoutToTimespec(long);
+static int downUntil(lpx_semaphore_t *, int, const struct timespec *);
+static int futexWait(volatile int *, int, const struct timespec *);
+static void futexWake(volatile int *, int);
+static int waitForValue(lpx_semaphore_t *, int, int, const struct timespec *);
+static int spinForValue(lpx_semaphore_t *, int);
+static int eventDown(lpx_semaphore_t *, int, const struct timespec *);
+static int millisUntil(const struct timespec *);
 
 /**
  * @brief  Initialize a semaphore. Starts off as fully available.
@@ -43,21 +58,113 @@ int lpx_sem_init(lpx_semaphore_t *sem, int maxValue)
    
     /* All parameters valid, initialize the semaphore. */
     sem->value = maxValue;
+    sem->waiters = 0;
+    sem->multiWaiters = 0;
+    sem->spins = -1;
+    sem->fd = -1;
+
+    /* Mark the semaphore as initalized and return it. */
+    sem->initialized = SEMAPHORE_INITIALIZED;
     
-    if (pthread_mutex_init(&sem->sem_mutex, NULL) != 0) {
+    return SEMAPHORE_SUCCESS;
+}
+
+/**
+ * @brief  Initialize a semaphore that spins for a while before a down goes to sleep.
+ *         Meant for quick handoffs between threads on different cores, where the up
+ *         usually comes before a sleep and wake up would be over. The spin is tuned
+ *         to how long recent downs had to wait. On a single CPU nothing can happen
+ *         while spinning, so the semaphore does not spin there.
+ * @param  sem      The semaphore to initialize.
+ * @param  maxValue The maximum value of the semaphore.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_sem_init_adaptive(lpx_semaphore_t *sem, int maxValue)
+{
+    if (0 != lpx_sem_init(sem, maxValue)) {
         return SEMAPHORE_FAILURE;
     }
 
-    if (pthread_cond_init(&sem->sem_cvar, NULL) != 0) {
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        sem->spins = 0;
+    }
+
+    return SEMAPHORE_SUCCESS;
+}
+
+/**
+ * @brief  Initialize a semaphore that an event loop can wait on. Its value lives in
+ *         an eventfd in semaphore mode, which is readable whenever the value is
+ *         above 0, see lpx_sem_fd. Every operation is a system call. Downs take one
+ *         unit at a time, since a poll cannot wait for more than that. Ups may add
+ *         several.
+ * @param  sem      The semaphore to initialize.
+ * @param  maxValue The maximum value of the semaphore.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_sem_init_pollable(lpx_semaphore_t *sem, int maxValue)
+{
+    if (0 != lpx_sem_init(sem, maxValue)) {
         return SEMAPHORE_FAILURE;
     }
 
-    /* Mark the semaphore as initalized and return it. */
-    sem->initialized = SEMAPHORE_INITIALIZED;
-    
+    // Non blocking, so a reader that lost the race for a unit goes back to polling.
+    sem->fd = eventfd(maxValue, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sem->fd < 0) {
+        sem->initialized = 0;
+        return SEMAPHORE_FAILURE;
+    }
+    sem->value = 0;
+
     return SEMAPHORE_SUCCESS;
 }
 
+/**
+ * @brief  Get the file descriptor of a pollable semaphore. It polls readable while
+ *         the value is above 0. Several threads may be woken for one unit, so take
+ *         it with lpx_sem_try_down rather than a down that would block the loop.
+ * @param  sem The semaphore.
+ * @return The file descriptor, -1 if the semaphore is not pollable.
+ */
+int lpx_sem_fd(lpx_semaphore_t *sem)
+{
+    if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
+        return -1;
+    }
+
+    return sem->fd;
+}
+
+/**
+ * @brief  Decrement the semaphore value if that can be done without blocking.
+ * @param  sem The semaphore to decrement.
+ * @return 0 on success, -1 on failure, -2 if the value is 0, as if it timed out
+ *         right away.
+ */
+int lpx_sem_try_down(lpx_semaphore_t *sem)
+{
+    uint64_t unit = 0;
+    int current = 0;
+
+    if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
+        return SEMAPHORE_FAILURE;
+    }
+
+    if (sem->fd >= 0) {
+        if (read(sem->fd, &unit, sizeof(unit)) == sizeof(unit)) {
+            return SEMAPHORE_SUCCESS;
+        }
+        return (errno == EAGAIN) ? SEMAPHORE_TIMEOUT : SEMAPHORE_FAILURE;
+    }
+
+    while ((current = sem->value) > 0) {
+        if (__sync_bool_compare_and_swap(&sem->value, current, current - 1)) {
+            return SEMAPHORE_SUCCESS;
+        }
+    }
+    return SEMAPHORE_TIMEOUT;
+}
+
 /**
  * @brief  Destroy a semaphore.
  * @param  sem The semaphore to destroy.
@@ -70,9 +177,11 @@ int lpx_sem_destroy(lpx_semaphore_t *sem)
         return SEMAPHORE_FAILURE;
     }
 
+    if (sem->initialized == SEMAPHORE_INITIALIZED && sem->fd >= 0) {
+        close(sem->fd);
+        sem->fd = -1;
+    }
     sem->initialized = 0;
-    pthread_cond_destroy(&sem->sem_cvar);
-    pthread_mutex_destroy(&sem->sem_mutex);
    
     return SEMAPHORE_SUCCESS;
 }
@@ -128,66 +237,52 @@ int lpx_sem_op(lpx_semaphore_t *sem, int value)
  */
 int lpx_sem_down_multiple(lpx_semaphore_t *sem, int value)
 {
-    int retval = 0;
-
     if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
         return SEMAPHORE_FAILURE;
     }
-    
-    // Grab the mutex.
-    if (pthread_mutex_lock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
-    }
-
-    // Wait for a time when you are legally allowed to decrement the semaphore.
-    while (sem->value < value) {
-        retval = pthread_cond_wait(&sem->sem_cvar, &sem->sem_mutex);
-        
-        if (retval != 0) {
-            return SEMAPHORE_FAILURE;
-        }
-    }
 
-    // Definitely most certainly have the mutex here.
-    sem->value -= value;
-
-    // Unlock the mutex and exit.
-    if (pthread_mutex_unlock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
-    }
-    
-    return SEMAPHORE_SUCCESS;
+    return downUntil(sem, value, NULL);
 }
 
 /**
- * @brief  Add a value to the semaphore.
+ * @brief  Add a value to the semaphore. Wakes as many waiters as the value lets
+ *         through, and none at all if nobody waits.
  * @param  sem The semaphore to operate on.
  * @param  value The value to add to the semaphore.
  * @return 0 on success, -1 on failure.
  */
 int lpx_sem_up_multiple(lpx_semaphore_t *sem, int value)
 {
+    uint64_t units = value;
+    int waiters = 0;
+
     if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
         return SEMAPHORE_FAILURE;
     }
 
-    // Grab the mutex.
-    if (pthread_mutex_lock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
+    // The eventfd wakes its pollers and readers itself.
+    if (sem->fd >= 0) {
+        if (value <= 0 || write(sem->fd, &units, sizeof(units)) != sizeof(units)) {
+            return SEMAPHORE_FAILURE;
+        }
+        return SEMAPHORE_SUCCESS;
     }
-    
+
     // Increment the semaphore value.
-    sem->value += value;
+    __sync_fetch_and_add(&sem->value, value);
 
-    // Unlock the mutex.
-    if (pthread_mutex_unlock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
+    waiters = sem->waiters;
+    if (LIKELY(waiters == 0)) {
+        return SEMAPHORE_SUCCESS;
     }
 
-    // Tell someone to wake up.
-    if (pthread_cond_signal(&sem->sem_cvar) != 0) {
-        pthread_mutex_unlock(&sem->sem_mutex);
-        return SEMAPHORE_FAILURE;
+    // Every unit lets one waiter through while they all want one. There is no telling
+    // which waiter the kernel picks, so anyone wanting more gets them all woken to
+    // check for themselves.
+    if (sem->multiWaiters > 0) {
+        futexWake(&sem->value, INT_MAX);
+    } else {
+        futexWake(&sem->value, value < waiters ? value : waiters);
     }
     
     return SEMAPHORE_SUCCESS;
@@ -215,6 +310,8 @@ int lpx_sem_timed_op(lpx_semaphore_t *sem, int value, long timeoutMillis)
 
 /**
  * @brief  Decrement the semaphore. Block for as long as the specified timeout.
+ *         The timeout is turned into a deadline with lpx_deadline_after, see
+ *         lpx_sem_down_until.
  * @param  sem The semaphore to decrement.
  * @param  value The value to decrement from the semaphore.
  * @param  timeoutMillis Timeout in milliseconds.
@@ -222,152 +319,267 @@ int lpx_sem_timed_op(lpx_semaphore_t *sem, int value, long timeoutMillis)
  */
 int lpx_sem_timed_down(lpx_semaphore_t *sem, int value, long timeoutMillis)
 {
-    struct timespec timeout;
-    struct timespec before;
-    struct timespec after;
-    int retval = 0;
+    struct timespec deadline;
 
-    if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
+    if (timeoutMillis <= 0) {
         return SEMAPHORE_FAILURE;
     }
 
+    deadline = lpx_deadline_after(timeoutMillis);
+    return lpx_sem_down_until(sem, value, &deadline);
+}
+
+/**
+ * @brief  Decrement the semaphore, blocking until an absolute deadline at most.
+ *         The deadline is on CLOCK_MONOTONIC, so changes to the wall clock do not
+ *         move it, and the kernel keeps the time while waiting.
+ * @param  sem The semaphore to decrement.
+ * @param  value The value to decrement from the semaphore.
+ * @param  deadline When to give up, on CLOCK_MONOTONIC.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+int lpx_sem_down_until(lpx_semaphore_t *sem, int value, const struct timespec *deadline)
+{
+    if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED || deadline == NULL ||
+        deadline->tv_sec < 0 || deadline->tv_nsec < 0 || deadline->tv_nsec >= 1000 * 1000 * 1000) {
+        return SEMAPHORE_FAILURE;
+    }
+
+    return downUntil(sem, value, deadline);
+}
+
+/**
+ * @brief  Timed version of sem_up_multiple. Ups never block, so this only differs
+ *         from it in checking the timeout.
+ * @param  sem The semaphore to operate on.
+ * @param  value The value to add to the semaphore.
+ * @param  timeoutMillis Timeout in milliseconds for the operation.
+ * @return 0 on success, -1 on failure, -2 on failure.
+ */
+int lpx_sem_timed_up(lpx_semaphore_t *sem, int value, long timeoutMillis)
+{
     if (timeoutMillis <= 0) {
         return SEMAPHORE_FAILURE;
-    } else {
-        timeout = timeoutToTimespec(timeoutMillis);
     }
 
-    // Grab the mutex with a maximum of the specified timeout.
-    clock_gettime(CLOCK_REALTIME, &before);
-    if ((retval = pthread_mutex_timedlock(&sem->sem_mutex, &timeout)) != 0) {
-        if (retval == ETIMEDOUT) {
-            return SEMAPHORE_TIMEOUT;
-        } else {
-            return SEMAPHORE_FAILURE;
-        }
+    return lpx_sem_up_multiple(sem, value);
+}
+
+/**
+ * @brief  Turn a timeout into a deadline on CLOCK_MONOTONIC, for the operations that
+ *         wait until a deadline.
+ * @param  timeoutMillis Time in milliseconds from now.
+ * @return The deadline.
+ */
+struct timespec lpx_deadline_after(long timeoutMillis)
+{
+    struct timespec time;
+     
+    memset(&time, 0, sizeof(struct timespec));
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    time.tv_sec += timeoutMillis / 1000;
+    time.tv_nsec += (timeoutMillis % 1000) * 1000 * 1000;
+    if (time.tv_nsec >= 1000 * 1000 * 1000) {
+        time.tv_nsec -= 1000 * 1000 * 1000;
+        time.tv_sec++;
     }
-    clock_gettime(CLOCK_REALTIME, &after);
-
-    // We measured how long that operation took. Now readjust the timeout
-    // such that it holds the remaining time.
-    timeoutMillis -= timespecDiffMillis(after, before);
-    if (timeoutMillis < 0) {
-        pthread_mutex_unlock(&sem->sem_mutex);
-        return SEMAPHORE_TIMEOUT;
-    }
-
-    // Wait for a time when you are legally allowed to decrement the semaphore.
-    while (sem->value < value) {
-        timeout = timeoutToTimespec(timeoutMillis);
-        clock_gettime(CLOCK_REALTIME, &before);
-        retval = pthread_cond_timedwait(&sem->sem_cvar, &sem->sem_mutex, &timeout);
-        
-        clock_gettime(CLOCK_REALTIME, &after);
-        timeoutMillis -= timespecDiffMillis(after, before);
-        
-        // Cvar wait timed out or failed.
-        if (retval == ETIMEDOUT) {
-           pthread_mutex_unlock(&sem->sem_mutex);
-           return SEMAPHORE_TIMEOUT;
-        }
-        if (retval != 0) {
-           return SEMAPHORE_FAILURE;
+
+    return time;
+}
+
+/**
+ * @brief  Take a value off a semaphore, sleeping until it is there or a deadline
+ *         passes. The clock is never read here, the kernel times out the sleep.
+ * @param  sem The semaphore to decrement.
+ * @param  value The value to decrement from the semaphore.
+ * @param  deadline When to give up, on CLOCK_MONOTONIC, NULL to wait forever.
+ * @return 0 on success, -1 on failure, -2 on timeout.
+ */
+static int downUntil(lpx_semaphore_t *sem, int value, const struct timespec *deadline)
+{
+    int spun = (sem->spins < 0);
+    int timedOut = 0;
+    int current = 0;
+
+    if (sem->fd >= 0) {
+        return eventDown(sem, value, deadline);
+    }
+
+    for (;;) {
+        current = sem->value;
+        if (LIKELY(current >= value)) {
+            if (__sync_bool_compare_and_swap(&sem->value, current, current - value)) {
+                return SEMAPHORE_SUCCESS;
+            }
+            continue;
         }
 
-        // Cvar wait succeeded but we dont have any more time left. Too bad.
-        if (timeoutMillis <= 0) {
-            pthread_mutex_unlock(&sem->sem_mutex);
+        // The value was checked once more after the deadline passed.
+        if (timedOut) {
             return SEMAPHORE_TIMEOUT;
         }
+
+        // Spin once before the first sleep, the value is read again either way.
+        if (!spun) {
+            spun = 1;
+            spinForValue(sem, value);
+            continue;
+        }
+
+        // Only a change of value, a signal or the deadline may end the sleep.
+        if (0 != waitForValue(sem, current, value, deadline)) {
+            if (errno == ETIMEDOUT) {
+                timedOut = 1;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                return SEMAPHORE_FAILURE;
+            }
+        }
     }
+}
 
-    // Definitely most certainly have the mutex here.
-    sem->value -= value;
+/**
+ * @brief  Spin until a semaphore reaches a value or the spin runs out. Like the adaptive
+ *         mutexes of glibc, the bound is twice the running average of past spins plus
+ *         a little, so it settles around how long downs usually have to wait.
+ * @param  sem   An adaptive semaphore.
+ * @param  value The value to wait for.
+ * @return 1 if the value was reached, 0 if the spin ran out.
+ */
+static int spinForValue(lpx_semaphore_t *sem, int value)
+{
+    int maxSpins = sem->spins * 2 + 10;
+    int spins = 0;
 
-    // Unlock the mutex and exit.
-    if (pthread_mutex_unlock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
+    if (maxSpins > SEMAPHORE_MAX_SPINS) {
+        maxSpins = SEMAPHORE_MAX_SPINS;
     }
-    
-    return SEMAPHORE_SUCCESS;
+
+    while (spins < maxSpins && sem->value < value) {
+        CPU_PAUSE();
+        spins++;
+    }
+    sem->spins += (spins - sem->spins) / 8;
+
+    return spins < maxSpins;
 }
 
 /**
- * @brief  Timed version of sem_up_multiple. The timeout is not guaranteed to be 
- *         exact in any situation. It depends on more factors than can be controlled
- *         from userspace.
- * @param  sem The semaphore to operate on.
- * @param  value The value to add to the semaphore.
- * @param  timeoutMillis Timeout in milliseconds for the operation.
- * @return 0 on success, -1 on failure, -2 on failure.
+ * @brief  Take a unit off a pollable semaphore, polling its eventfd while it is empty.
+ *         Only single units are taken. Units taken one by one would be held while
+ *         sleeping, and two threads each holding some could wait on each other forever.
+ * @param  sem The semaphore to decrement.
+ * @param  value The value to decrement from the semaphore, must be 1.
+ * @param  deadline When to give up, on CLOCK_MONOTONIC, NULL to wait forever.
+ * @return 0 on success, -1 on failure, -2 on timeout.
  */
-int lpx_sem_timed_up(lpx_semaphore_t *sem, int value, long timeoutMillis)
+static int eventDown(lpx_semaphore_t *sem, int value, const struct timespec *deadline)
 {
-    struct timespec timeout;
+    struct pollfd pollFd;
+    uint64_t unit = 0;
     int retval = 0;
 
-    if (sem == NULL || sem->initialized != SEMAPHORE_INITIALIZED) {
+    if (value != 1) {
         return SEMAPHORE_FAILURE;
     }
 
-    if (timeoutMillis <= 0) {
-        return SEMAPHORE_FAILURE;
-    } else {
-        timeout = timeoutToTimespec(timeoutMillis);
-    }
+    pollFd.fd = sem->fd;
+    pollFd.events = POLLIN;
+    for (;;) {
+        if (read(sem->fd, &unit, sizeof(unit)) == sizeof(unit)) {
+            return SEMAPHORE_SUCCESS;
+        }
+        if (errno != EAGAIN && errno != EINTR) {
+            return SEMAPHORE_FAILURE;
+        }
 
-    // Grab the mutex.
-    if ((retval = pthread_mutex_timedlock(&sem->sem_mutex, &timeout)) != 0) {
-        if (retval == ETIMEDOUT) {
+        retval = poll(&pollFd, 1, (deadline == NULL) ? -1 : millisUntil(deadline));
+        if (retval == 0) {
             return SEMAPHORE_TIMEOUT;
-        } else {
+        }
+        if (retval < 0 && errno != EINTR) {
             return SEMAPHORE_FAILURE;
         }
     }
-    
-    // Increment the semaphore value.
-    sem->value += value;
+}
 
-    // Unlock the mutex.
-    if (pthread_mutex_unlock(&sem->sem_mutex) != 0) {
-        return SEMAPHORE_FAILURE;
+/**
+ * @brief  Work out how many milliseconds are left until a deadline, for poll.
+ * @param  deadline The deadline, on CLOCK_MONOTONIC.
+ * @return The time left rounded up, so a poll does not wake up just short of the
+ *         deadline, 0 if it passed.
+ */
+static int millisUntil(const struct timespec *deadline)
+{
+    struct timespec now;
+    long millis = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    millis = (deadline->tv_sec - now.tv_sec) * 1000 + 
+             (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+    if (millis <= 0) {
+        return 0;
     }
 
-    // Tell someone to wake up.
-    if (pthread_cond_signal(&sem->sem_cvar) != 0) {
-        pthread_mutex_unlock(&sem->sem_mutex);
-        return SEMAPHORE_FAILURE;
-    }
-    
-    return SEMAPHORE_SUCCESS;
+    return (millis > INT_MAX) ? INT_MAX : millis;
 }
 
 /**
- * @brief  Helper method to convert a timout value in milliseconds to a 
- *         struct timespec that is in absolute time.
- * @param  timeoutMillis Time in milliseconds.
- * @return The same value represented in a struct timespec as absolute time.
+ * @brief  Sleep until the value of a semaphore changes. The wait is announced before
+ *         sleeping and the kernel only puts the thread to sleep if the value is still
+ *         what it saw, so an up in between is never missed.
+ * @param  sem     The semaphore.
+ * @param  current The value that was too small.
+ * @param  value   The value the thread wants to take.
+ * @param  deadline When to stop sleeping, on CLOCK_MONOTONIC, NULL to sleep until woken.
+ * @return 0 when woken, -1 with errno set otherwise, see futexWait.
  */
-static struct timespec timeoutToTimespec(long timeoutMillis)
+static int waitForValue(lpx_semaphore_t *sem, int current, int value, 
+                        const struct timespec *deadline)
 {
-    struct timespec time;
-    long timeoutSec = 0;
-    long timeoutNanos = 0;
-     
-    memset(&time, 0, sizeof(struct timespec));
-    timeoutSec = timeoutMillis / 1000;
-    timeoutMillis -= (timeoutSec * 1000);
-    timeoutNanos = timeoutMillis * 1000 * 1000;
-
-    clock_gettime(CLOCK_REALTIME, &time);
-    time.tv_sec += timeoutSec;
-    time.tv_nsec += timeoutNanos;
-    if (time.tv_nsec > 1024 * 1024 * 1024) {
-        time.tv_nsec %= (1024 * 1024 * 1024);
-        time.tv_sec++;
+    int retval = 0;
+    int error = 0;
+
+    __sync_fetch_and_add(&sem->waiters, 1);
+    if (value > 1) {
+        __sync_fetch_and_add(&sem->multiWaiters, 1);
     }
 
-    return time;
+    retval = futexWait(&sem->value, current, deadline);
+    error = errno;
+
+    if (value > 1) {
+        __sync_fetch_and_sub(&sem->multiWaiters, 1);
+    }
+    __sync_fetch_and_sub(&sem->waiters, 1);
+
+    errno = error;
+    return retval;
+}
+
+/**
+ * @brief  Sleep on a futex as long as it holds the expected value. The bitset flavour
+ *         of the wait takes an absolute time on CLOCK_MONOTONIC, the plain one only
+ *         a relative one.
+ * @param  addr     The futex.
+ * @param  value    The value it is expected to hold.
+ * @param  deadline When to stop sleeping, NULL to sleep until woken.
+ * @return 0 when woken, -1 if the value was different (EAGAIN), the deadline passed
+ *         (ETIMEDOUT) or a signal came in (EINTR).
+ */
+static int futexWait(volatile int *addr, int value, const struct timespec *deadline)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, value, deadline, NULL, 
+                   FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * @brief  Wake threads that sleep on a futex.
+ * @param  addr  The futex.
+ * @param  count The most threads to wake.
+ */
+static void futexWake(volatile int *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
 }
 
 /**
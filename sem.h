@@ -1,7 +1,7 @@
 /**
  * @file   sem.h
  * @author Rakesh Iyer
- * @brief  Interface for the pthread semaphore implementation.
+ * @brief  Interface for the futex based semaphore implementation.
  * @bug    Not tested for performance.
  *
  * This program is free software: you can redistribute it and/or modify
@@ -27,6 +27,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include "asmopt.h"
 
 /**
  * @def   SEMAPHORE_SUCCESS
@@ -46,6 +48,12 @@
  */
 #define SEMAPHORE_TIMEOUT	-2
 
+/**
+ * @def   SEMAPHORE_MAX_SPINS
+ * @brief The most an adaptive semaphore spins before it goes to sleep.
+ */
+#define SEMAPHORE_MAX_SPINS	100
+
 /**
  * @def   SEMAPHORE_INITIALIZED
  * @brief Magic value to denote that a semaphore is initialized.
@@ -53,16 +61,25 @@
 #define SEMAPHORE_INITIALIZED	0xBAC0BAC0
 
 /**
- * @brief A struct that represents a semaphore.
+ * @brief A struct that represents a semaphore. The value is changed with atomic
+ *        operations and is also the futex that blocked threads sleep on, so ups and
+ *        downs that do not have to wait never enter the kernel. Pollable semaphores
+ *        keep their value in an eventfd instead.
  */
 typedef struct __semaphore_t {
     unsigned int initialized;   /**< Stores whether the semaphore is initalized. */
-    int value;                  /**< The current value of the semaphore. */
-    pthread_mutex_t sem_mutex;  /**< The mutex that protects the value. */
-    pthread_cond_t  sem_cvar;   /**< The cvar that threads wait on for the mutex. */
+    volatile int value;         /**< The current value of the semaphore. */
+    volatile int waiters;       /**< Threads that are asleep on the value or about to be. */
+    volatile int multiWaiters;  /**< The waiters among them that need more than one unit. */
+    int spins;                  /**< How long an adaptive semaphore spins, -1 if it never does. */
+    int fd;                     /**< The eventfd of a pollable semaphore, -1 for others. */
 }lpx_semaphore_t;
 
 int lpx_sem_init(lpx_semaphore_t *sem, int maxValue);
+int lpx_sem_init_adaptive(lpx_semaphore_t *sem, int maxValue);
+int lpx_sem_init_pollable(lpx_semaphore_t *sem, int maxValue);
+int lpx_sem_fd(lpx_semaphore_t *sem);
+int lpx_sem_try_down(lpx_semaphore_t *sem);
 int lpx_sem_destroy(lpx_semaphore_t *sem);
 int lpx_sem_up(lpx_semaphore_t *sem);
 int lpx_sem_down(lpx_semaphore_t *sem);
@@ -72,6 +89,9 @@ int lpx_sem_up_multiple(lpx_semaphore_t *sem, int);
 int lpx_sem_down_multiple(lpx_semaphore_t *sem, int);
 int lpx_sem_timed_down(lpx_semaphore_t *sem, int value, long timeoutMillis);
 int lpx_sem_timed_up(lpx_semaphore_t *sem, int value, long timeoutMillis);
+int lpx_sem_down_until(lpx_semaphore_t *sem, int value, const struct timespec *deadline);
+
+struct timespec lpx_deadline_after(long timeoutMillis);
 
 long timespecDiffMillis(struct timespec greater, struct timespec lesser);
 #endif
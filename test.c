@@ -10,7 +10,10 @@
 #include "pcQueue.h"
 #include "treemap.h"
 #include "arraylist.h"
+#include "arena.h"
 #include <assert.h>
+#include <sys/wait.h>
+#include <poll.h>
 
 
 //------------------------------- Semaphore Tests -----------------------------
@@ -75,6 +78,326 @@ void testSem3()
     return;
 }
 
+/**
+ * @brief  Bounce between two semaphores, the other end does the opposite.
+ * @param  arg The two semaphores, taken from the first and given to the second.
+ * @return Always NULL.
+ */
+void *pingPong(void *arg)
+{
+    lpx_semaphore_t *sems = (lpx_semaphore_t *)arg;
+    int i = 0;
+
+    for (i = 0; i < 100000; i++) {
+        assert(0 == lpx_sem_down(&sems[0]));
+        assert(0 == lpx_sem_up(&sems[1]));
+    }
+    return NULL;
+}
+
+/**
+ * @brief Test that sleeping on a semaphore never misses a wake up, and that the
+ *        uncontended path leaves no waiters behind.
+ */
+void testSem4()
+{
+    lpx_semaphore_t sems[2];
+    pthread_t tid;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_sem_init(&sems[0], 1));
+    assert(0 == lpx_sem_init(&sems[1], 1));
+    assert(0 == lpx_sem_down(&sems[0]) && 0 == lpx_sem_down(&sems[1]));
+    assert(sems[0].value == 0 && sems[0].waiters == 0);
+
+    assert(0 == pthread_create(&tid, NULL, pingPong, sems));
+    for (i = 0; i < 100000; i++) {
+        assert(0 == lpx_sem_up(&sems[0]));
+        assert(0 == lpx_sem_down(&sems[1]));
+    }
+    assert(0 == pthread_join(tid, NULL));
+    assert(sems[0].value == 0 && sems[1].value == 0);
+    assert(sems[0].waiters == 0 && sems[1].waiters == 0);
+
+    assert(-2 == lpx_sem_timed_down(&sems[0], 1, 10));
+    assert(0 == lpx_sem_destroy(&sems[0]));
+    assert(0 == lpx_sem_destroy(&sems[1]));
+    printf("Test testSem4 passed.\n");
+    return;
+}
+
+/**
+ * @brief  Take a unit off a semaphore, giving up after a few seconds.
+ * @param  arg The semaphore.
+ * @return Always NULL.
+ */
+void *takeUnit(void *arg)
+{
+    assert(0 == lpx_sem_timed_down((lpx_semaphore_t *)arg, 1, 5000));
+    return NULL;
+}
+
+/**
+ * @brief  Take three units off a semaphore at once, giving up after a few seconds.
+ * @param  arg The semaphore.
+ * @return Always NULL.
+ */
+void *takeThreeUnits(void *arg)
+{
+    assert(0 == lpx_sem_timed_down((lpx_semaphore_t *)arg, 3, 5000));
+    return NULL;
+}
+
+/**
+ * @brief Test that an up of several units wakes all the waiters it can let through,
+ *        including waiters that need more than one unit.
+ */
+void testSem5()
+{
+    lpx_semaphore_t sem;
+    pthread_t tids[8];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_sem_init(&sem, 1));
+    assert(0 == lpx_sem_down(&sem));
+    for (i = 0; i < 8; i++) {
+        assert(0 == pthread_create(&tids[i], NULL, takeUnit, &sem));
+        while (sem.waiters != i + 1) {
+            usleep(1000);
+        }
+    }
+
+    // One up has to release every waiter at once.
+    assert(0 == lpx_sem_up_multiple(&sem, 8));
+    for (i = 0; i < 8; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
+    }
+    assert(sem.value == 0 && sem.waiters == 0 && sem.multiWaiters == 0);
+
+    // A waiter for three units must not keep a waiter for one asleep.
+    assert(0 == pthread_create(&tids[0], NULL, takeThreeUnits, &sem));
+    while (sem.multiWaiters != 1) {
+        usleep(1000);
+    }
+    assert(0 == pthread_create(&tids[1], NULL, takeUnit, &sem));
+    while (sem.waiters != 2) {
+        usleep(1000);
+    }
+    assert(0 == lpx_sem_up(&sem));
+    assert(0 == pthread_join(tids[1], NULL));
+    assert(0 == lpx_sem_up_multiple(&sem, 2));
+    usleep(10000);
+    assert(sem.value == 2 && sem.multiWaiters == 1);
+    assert(0 == lpx_sem_up(&sem));
+    assert(0 == pthread_join(tids[0], NULL));
+    assert(sem.value == 0 && sem.waiters == 0 && sem.multiWaiters == 0);
+    assert(0 == lpx_sem_destroy(&sem));
+    printf("Test testSem5 passed.\n");
+    return;
+}
+
+/**
+ * @brief Test adaptive semaphores. They spin even on a single CPU here, so the spin
+ *        path is always covered.
+ */
+void testSem6()
+{
+    lpx_semaphore_t sems[2];
+    pthread_t tid;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_sem_init_adaptive(&sems[0], 1));
+    assert(0 == lpx_sem_init_adaptive(&sems[1], 1));
+    assert(sems[0].spins == (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 0 : -1));
+    sems[0].spins = sems[1].spins = 0;
+    assert(0 == lpx_sem_down(&sems[0]) && 0 == lpx_sem_down(&sems[1]));
+
+    assert(0 == pthread_create(&tid, NULL, pingPong, sems));
+    for (i = 0; i < 100000; i++) {
+        assert(0 == lpx_sem_up(&sems[0]));
+        assert(0 == lpx_sem_down(&sems[1]));
+    }
+    assert(0 == pthread_join(tid, NULL));
+    assert(sems[0].value == 0 && sems[1].value == 0);
+    assert(sems[0].spins >= 0 && sems[0].spins <= SEMAPHORE_MAX_SPINS);
+    assert(sems[1].spins >= 0 && sems[1].spins <= SEMAPHORE_MAX_SPINS);
+
+    assert(-2 == lpx_sem_timed_down(&sems[0], 1, 10));
+    assert(0 == lpx_sem_destroy(&sems[0]));
+    assert(0 == lpx_sem_destroy(&sems[1]));
+    printf("Test testSem6 passed.\n");
+    return;
+}
+
+/**
+ * @brief  Give a semaphore a unit after a short while.
+ * @param  arg The semaphore.
+ * @return Always NULL.
+ */
+void *upLater(void *arg)
+{
+    usleep(20000);
+    assert(0 == lpx_sem_up((lpx_semaphore_t *)arg));
+    return NULL;
+}
+
+/**
+ * @brief Test pollable semaphores, waiting on their file descriptor the way an event
+ *        loop would.
+ */
+void testSem7()
+{
+    lpx_semaphore_t sem;
+    struct pollfd pollFd;
+    pthread_t tid;
+
+    printf("=======================================\n");
+    assert(0 == lpx_sem_init(&sem, 1));
+    assert(-1 == lpx_sem_fd(&sem));
+    assert(0 == lpx_sem_try_down(&sem) && -2 == lpx_sem_try_down(&sem));
+    assert(0 == lpx_sem_destroy(&sem));
+
+    assert(0 == lpx_sem_init_pollable(&sem, 2));
+    pollFd.fd = lpx_sem_fd(&sem);
+    pollFd.events = POLLIN;
+    assert(pollFd.fd >= 0 && 1 == poll(&pollFd, 1, 0));
+    assert(-1 == lpx_sem_down_multiple(&sem, 2));
+    assert(0 == lpx_sem_down(&sem) && 0 == lpx_sem_try_down(&sem));
+    assert(0 == poll(&pollFd, 1, 0));
+    assert(-2 == lpx_sem_try_down(&sem));
+
+    // The descriptor turns readable once another thread ups the semaphore.
+    assert(0 == pthread_create(&tid, NULL, upLater, &sem));
+    assert(1 == poll(&pollFd, 1, 5000) && (pollFd.revents & POLLIN));
+    assert(0 == lpx_sem_try_down(&sem));
+    assert(0 == pthread_join(tid, NULL));
+    assert(-2 == lpx_sem_timed_down(&sem, 1, 10));
+
+    // Blocking downs wait on the descriptor too.
+    assert(0 == pthread_create(&tid, NULL, upLater, &sem));
+    assert(0 == lpx_sem_down(&sem));
+    assert(0 == pthread_join(tid, NULL));
+    assert(0 == lpx_sem_up_multiple(&sem, 3));
+    assert(-1 == lpx_sem_timed_down(&sem, 3, 10));
+    assert(0 == lpx_sem_timed_down(&sem, 1, 10));
+    assert(0 == lpx_sem_down(&sem) && 0 == lpx_sem_try_down(&sem));
+    assert(-2 == lpx_sem_try_down(&sem));
+    assert(0 == lpx_sem_destroy(&sem));
+    printf("Test testSem7 passed.\n");
+    return;
+}
+
+//---------------------------- Reader writer lock Tests -----------------------
+static long rwlockCounter = 0;
+
+/**
+ * @brief  Bump a counter under the writer lock and check it under the reader lock.
+ * @param  arg The lock.
+ * @return Always NULL.
+ */
+void *bumpCounter(void *arg)
+{
+    lpx_rwlock_t *rwlock = (lpx_rwlock_t *)arg;
+    long seen = 0;
+    int i = 0;
+
+    for (i = 0; i < 100000; i++) {
+        assert(0 == lpx_rwlock_acquire_writer_lock(rwlock));
+        seen = ++rwlockCounter;
+        assert(0 == lpx_rwlock_release_writer_lock(rwlock));
+        assert(0 == lpx_rwlock_acquire_reader_lock(rwlock));
+        assert(rwlockCounter >= seen);
+        assert(0 == lpx_rwlock_release_reader_lock(rwlock));
+    }
+    return NULL;
+}
+
+/**
+ * @brief Test that adaptive reader writer locks still exclude writers from each other.
+ */
+void testRwlock1()
+{
+    lpx_rwlock_t rwlock;
+    pthread_t tids[4];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_rwlock_init_adaptive(&rwlock));
+    rwlock.spins = 0;
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_create(&tids[i], NULL, bumpCounter, &rwlock));
+    }
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
+    }
+    assert(rwlockCounter == 400000 && rwlock.value == 0);
+    assert(rwlock.spins >= 0 && rwlock.spins <= RWLOCK_MAX_SPINS);
+    assert(0 == lpx_rwlock_destroy(&rwlock));
+    printf("Test testRwlock1 passed.\n");
+    return;
+}
+
+/**
+ * @brief Test the operations that wait until a deadline on the monotonic clock.
+ */
+void testDeadlines1()
+{
+    lpx_semaphore_t sem;
+    lpx_rwlock_t rwlock;
+    lpx_pcq_t queue;
+    struct timespec deadline;
+    struct timespec now;
+    void *data = NULL;
+
+    printf("=======================================\n");
+    assert(0 == lpx_sem_init(&sem, 1));
+    assert(-1 == lpx_sem_down_until(&sem, 1, NULL));
+
+    // A deadline that passed only matters when there is something to wait for.
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    assert(0 == lpx_sem_down_until(&sem, 1, &deadline));
+    assert(-2 == lpx_sem_down_until(&sem, 1, &deadline));
+
+    deadline = lpx_deadline_after(50);
+    assert(-2 == lpx_sem_down_until(&sem, 1, &deadline));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    assert(now.tv_sec > deadline.tv_sec || 
+           (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec));
+    assert(-2 == lpx_sem_timed_down(&sem, 1, 20));
+
+    // A deadline the kernel would refuse fails instead of waiting.
+    deadline.tv_nsec = 1000 * 1000 * 1000;
+    assert(-1 == lpx_sem_down_until(&sem, 1, &deadline));
+    deadline.tv_nsec = -1;
+    assert(-1 == lpx_sem_down_until(&sem, 1, &deadline));
+    assert(0 == lpx_sem_up(&sem));
+    assert(0 == lpx_sem_destroy(&sem));
+
+    assert(0 == lpx_rwlock_init(&rwlock));
+    assert(0 == lpx_rwlock_acquire_writer_lock(&rwlock));
+    deadline = lpx_deadline_after(20);
+    assert(-2 == lpx_rwlock_acquire_reader_lock_until(&rwlock, &deadline));
+    assert(-2 == lpx_rwlock_acquire_writer_lock_until(&rwlock, &deadline));
+    assert(-2 == lpx_rwlock_acquire_writer_lock_timed(&rwlock, 20));
+    assert(0 == lpx_rwlock_release_writer_lock(&rwlock));
+    assert(0 == lpx_rwlock_acquire_reader_lock_until(&rwlock, &deadline));
+    assert(0 == lpx_rwlock_release_reader_lock(&rwlock));
+    assert(0 == lpx_rwlock_destroy(&rwlock));
+
+    assert(0 == lpx_pcq_init(&queue, 1));
+    deadline = lpx_deadline_after(20);
+    assert(-2 == lpx_pcq_dequeue_until(&queue, &data, &deadline));
+    assert(0 == lpx_pcq_enqueue_until(&queue, &queue, &deadline));
+    assert(-2 == lpx_pcq_enqueue_until(&queue, &queue, &deadline));
+    assert(0 == lpx_pcq_dequeue_until(&queue, &data, &deadline) && data == &queue);
+    assert(0 == lpx_pcq_destroy(&queue));
+    printf("Test testDeadlines1 passed.\n");
+    return;
+}
+
 //------------------------------ Thread pool Tests ----------------------------
 
 int sanityCounter = 0; /**< A stupid way to count the number of executions. */
@@ -266,216 +589,1305 @@ void testThreadPool5()
 //--------------------------------- Barrier Tests -----------------------------
 
 /**
- * @def BARRIERTEST1_NUM_ITERATIONS
- * @brief Number of iterations that each thread will make in barrierTest.
- */
-#define BARRIERTEST1_NUM_ITERATIONS	128
-/**
- * @def BARRIERTEST1_NUM_THREADS
- * @brief Number of threads in barrierTest1
+ * @def BARRIERTEST1_NUM_ITERATIONS
+ * @brief Number of iterations that each thread will make in barrierTest.
+ */
+#define BARRIERTEST1_NUM_ITERATIONS	128
+/**
+ * @def BARRIERTEST1_NUM_THREADS
+ * @brief Number of threads in barrierTest1
+ */
+#define BARRIERTEST1_NUM_THREADS	4
+
+char barrierOutArray[BARRIERTEST1_NUM_ITERATIONS * BARRIERTEST1_NUM_THREADS]; /**< Output array for barrierTest1 threads. */
+pthread_mutex_t barrierTest1Mutex;  /**< Mutex to protect barrierOutArray */
+int barrierTest1Index;   /**< Current index to write to in barrierOutArray */
+
+/**
+ * @brief Test function for barriers.
+ * @param arg Will hold the barrier that we need to synchronize on.
+ * @return Ignored.
+ */
+void *barrierTest(void *arg)
+{
+    int i = 0;
+    lpx_barrier_t *barrier = (lpx_barrier_t *)arg;
+    for(i = 0; i < BARRIERTEST1_NUM_ITERATIONS; i++) {
+        pthread_mutex_lock(&barrierTest1Mutex);
+	barrierOutArray[barrierTest1Index++] = i;
+	pthread_mutex_unlock(&barrierTest1Mutex);
+	
+	lpx_barrier_sync(barrier);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Test case for barriers.
+ */
+void testBarrier1()
+{
+    int i = 0;
+    int n = 0;
+    int index = 0;
+    int *retval = NULL;
+    lpx_thread_future_t *future[BARRIERTEST1_NUM_THREADS];
+    lpx_barrier_t barrier;
+
+    barrierTest1Index = 0;
+    pthread_mutex_init(&barrierTest1Mutex, NULL);
+
+    lpx_threadpool_t *pool = lpx_threadpool_init(BARRIERTEST1_NUM_THREADS, \
+                                           BARRIERTEST1_NUM_THREADS, THREAD_POOL_FIXED);
+    assert(pool != NULL);
+
+    assert(0 == lpx_create_barrier(&barrier, BARRIERTEST1_NUM_THREADS));
+    printf("=======================================\n");
+
+    for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
+        future[i] = lpx_threadpool_execute(pool, barrierTest, (void *)&barrier);
+        assert (future[i] != NULL);
+    }
+
+    for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
+        assert(0 == lpx_threadpool_join(future[i], (void **)&retval));
+    }
+
+    for (n = 0; n < BARRIERTEST1_NUM_ITERATIONS; n++) {
+        for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
+            assert(barrierOutArray[index++] == n);
+        }
+    }
+
+    assert(0 == lpx_threadpool_destroy(pool));
+    assert(0 == lpx_destroy_barrier(&barrier));
+    printf("Test testBarrier1 passed.\n");
+    return;
+}
+
+
+//---------------------------- fixed mem pool Tests ---------------------------
+
+/**
+ * @brief Sanity test for the unprotected fixed sized memory pools.
+ */
+void testFixedMemPool1()
+{
+    lpx_mempool_fixed_t pool;
+    char *object1;
+    char *object2;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 2, MEMPOOL_UNPROTECTED));
+    object1 = lpx_mempool_fixed_alloc(&pool);
+    assert(object1 != NULL);
+    memset(object1, 0, 64);
+    
+    object2 = lpx_mempool_fixed_alloc(&pool);
+    assert(object2 != NULL);
+    memset(object2, 1, 64);
+
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    assert(0 == lpx_mempool_fixed_free(object1));
+    assert(0 == lpx_mempool_fixed_free(object2));
+
+    assert(NULL != lpx_mempool_fixed_alloc(&pool));
+    assert(NULL != lpx_mempool_fixed_alloc(&pool));
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool1 passed.\n");
+    return;
+}
+
+/**
+ * @brief Sanity check the protected fixed sized memory pools.
+ */
+void testFixedMemPool2()
+{
+    lpx_mempool_fixed_t pool;
+    char *object1;
+    char *object2;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 2, MEMPOOL_PROTECTED));
+    object1 = lpx_mempool_fixed_alloc(&pool);
+    assert(object1 != NULL);
+    memset(object1, 0, 64);
+    
+    object2 = lpx_mempool_fixed_alloc(&pool);
+    assert(object2 != NULL);
+    memset(object2, 1, 64);
+
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    assert(0 == lpx_mempool_fixed_free(object1));
+    assert(0 == lpx_mempool_fixed_free(object2));
+
+    assert(NULL != lpx_mempool_fixed_alloc(&pool));
+    assert(NULL != lpx_mempool_fixed_alloc(&pool));
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool2 passed.\n");
+}
+
+/**
+ * @brief  Free a bunch of objects from another thread so they land in its cache.
+ * @param  arg A NULL terminated array of objects to free.
+ * @return Always NULL.
+ */
+void *freeObjects(void *arg)
+{
+    void **objects = (void **)arg;
+    int i = 0;
+
+    for (i = 0; objects[i] != NULL; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check that thread cached pools can hand out every object, even the ones
+ *        that were freed into the cache of another thread.
+ */
+void testFixedMemPool3()
+{
+    lpx_mempool_fixed_t pool;
+    void *objects[101];
+    pthread_t tid;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(-1 == lpx_mempool_create_fixed_pool(&pool, 64, 100, 
+                                               MEMPOOL_UNPROTECTED | MEMPOOL_THREAD_CACHE));
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 100, 
+                                              MEMPOOL_PROTECTED | MEMPOOL_THREAD_CACHE));
+    for (i = 0; i < 100; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, 64);
+    }
+    objects[100] = NULL;
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+
+    // Free everything on another thread.
+    assert(0 == pthread_create(&tid, NULL, freeObjects, objects));
+    assert(0 == pthread_join(tid, NULL));
+
+    // Everything should be available here again.
+    for (i = 0; i < 100; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    objects[50] = NULL;
+    assert(NULL == freeObjects(objects));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool3 passed.\n");
+}
+
+/**
+ * @brief  Allocate and free objects from a pool in a tight loop.
+ * @param  arg The pool to hammer.
+ * @return Always NULL.
+ */
+void *hammerPool(void *arg)
+{
+    lpx_mempool_fixed_t *pool = (lpx_mempool_fixed_t *)arg;
+    long *objects[8];
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < 100000; i++) {
+        for (j = 0; j < 8; j++) {
+            objects[j] = lpx_mempool_fixed_alloc(pool);
+            assert(objects[j] != NULL);
+            *objects[j] = (long)objects[j];
+        }
+        for (j = 0; j < 8; j++) {
+            assert(*objects[j] == (long)objects[j]);
+            assert(0 == lpx_mempool_fixed_free(objects[j]));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sanity check the lock free fixed sized memory pools.
+ */
+void testFixedMemPool4()
+{
+    lpx_mempool_fixed_t pool;
+    pthread_t tids[4];
+    void *objects[32];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 32, MEMPOOL_LOCKFREE));
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_create(&tids[i], NULL, hammerPool, &pool));
+    }
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
+    }
+
+    // Nothing should have been lost or handed out twice.
+    for (i = 0; i < 32; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    for (i = 0; i < 32; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool4 passed.\n");
+}
+
+/**
+ * @brief Check that growable fixed pools add slabs when they run out and release
+ *        them again once they are free.
+ */
+void testFixedMemPool5()
+{
+    lpx_mempool_fixed_t pool;
+    lpx_mempool_fixed_slab_t *slab = NULL;
+    void *objects[20];
+    int numSlabs = 0;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 4, MEMPOOL_PROTECTED));
+    assert(0 == lpx_mempool_set_fixed_pool_growth(&pool, 4, 4));
+    for (i = 0; i < 20; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, 64);
+    }
+    for (slab = pool.slabs; slab != NULL; slab = slab->next) {
+        numSlabs++;
+    }
+    assert(numSlabs == 4);
+
+    // Only enough slabs to stay above the low water mark should survive.
+    for (i = 0; i < 20; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+    assert(pool.freeCount >= 4 && pool.freeCount < 20);
+
+    for (i = 0; i < 20; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+
+    // Lock free pools can grow but never shrink.
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 4, MEMPOOL_LOCKFREE));
+    assert(-1 == lpx_mempool_set_fixed_pool_growth(&pool, 4, 4));
+    assert(0 == lpx_mempool_set_fixed_pool_growth(&pool, 4, -1));
+    for (i = 0; i < 20; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool5 passed.\n");
+}
+
+/**
+ * @brief Check bulk allocations and frees, including frees that span several pools.
+ */
+void testFixedMemPool6()
+{
+    lpx_mempool_fixed_t pool1;
+    lpx_mempool_fixed_t pool2;
+    void *objects[40];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool1, 64, 20, MEMPOOL_PROTECTED));
+    assert(0 == lpx_mempool_create_fixed_pool(&pool2, 64, 20, MEMPOOL_LOCKFREE));
+
+    assert(15 == lpx_mempool_fixed_alloc_bulk(&pool1, objects, 15));
+    assert(5 == lpx_mempool_fixed_alloc_bulk(&pool1, objects + 15, 10));
+    assert(0 == lpx_mempool_fixed_alloc_bulk(&pool1, objects + 20, 1));
+    assert(20 == lpx_mempool_fixed_alloc_bulk(&pool2, objects + 20, 30));
+    for (i = 0; i < 40; i++) {
+        memset(objects[i], i, 64);
+    }
+
+    assert(0 == lpx_mempool_fixed_free_bulk(objects, 40));
+    assert(20 == lpx_mempool_fixed_alloc_bulk(&pool1, objects, 20));
+    assert(20 == lpx_mempool_fixed_alloc_bulk(&pool2, objects + 20, 20));
+    for (i = 0; i < 40; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool1));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool2));
+    printf("Test testFixedMemPool6 passed.\n");
+}
+
+/**
+ * @brief Check that aligned pools hand out packed objects at the requested alignment.
+ */
+void testFixedMemPool7()
+{
+    lpx_mempool_fixed_t pool;
+    char *objects[2000];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(-1 == lpx_mempool_create_aligned_fixed_pool(&pool, 64, 48, 10, MEMPOOL_PROTECTED));
+    assert(0 == lpx_mempool_create_aligned_fixed_pool(&pool, 64, 64, 2000, MEMPOOL_PROTECTED));
+    for (i = 0; i < 2000; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+        assert(((long)objects[i] & 63) == 0);
+        memset(objects[i], i, 64);
+    }
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+
+    // Consecutive objects of a slab should be exactly one cache line apart.
+    assert(objects[0] + 64 == objects[1] || objects[1] + 64 == objects[0]);
+
+    for (i = 0; i < 2000; i++) {
+        assert(0 == lpx_mempool_aligned_free(objects[i]));
+    }
+    for (i = 0; i < 2000; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+
+    assert(0 == lpx_mempool_create_aligned_fixed_pool(&pool, 24, 32, 100, MEMPOOL_LOCKFREE));
+    assert(100 == lpx_mempool_fixed_alloc_bulk(&pool, (void **)objects, 200));
+    for (i = 0; i < 100; i++) {
+        assert(((long)objects[i] & 31) == 0);
+        assert(0 == lpx_mempool_aligned_free(objects[i]));
+    }
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool7 passed.\n");
+}
+
+/**
+ * @brief Test fixed pools that are backed by huge pages.
+ */
+void testFixedMemPool8()
+{
+    lpx_mempool_fixed_t pool;
+    char *objects[1000];
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 120, 1000, 
+                                              MEMPOOL_PROTECTED | MEMPOOL_HUGEPAGES | MEMPOOL_POPULATE));
+    // Pinning can fail for lack of privileges, but must not break the pool.
+    if (0 == lpx_mempool_pin_fixed_pool(&pool)) {
+        assert(0 == lpx_mempool_unpin_fixed_pool(&pool));
+    }
+    for (i = 0; i < 1000; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, 120);
+    }
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    for (i = 0; i < 1000; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 100, MEMPOOL_LOCKFREE | MEMPOOL_POPULATE));
+    assert(100 == lpx_mempool_fixed_alloc_bulk(&pool, (void **)objects, 100));
+    assert(0 == lpx_mempool_fixed_free_bulk((void **)objects, 100));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool8 passed.\n");
+}
+
+/**
+ * @brief Test NUMA pools, objects have to find their way back to their node's sub-pool.
+ */
+void testFixedMemPool9()
+{
+    lpx_mempool_numa_t pool;
+    void *objects[400];
+    int total = 0;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_numa_pool(&pool, 48, 100, MEMPOOL_PROTECTED));
+    assert(pool.numNodes >= 1);
+    total = pool.numNodes * 100 < 400 ? pool.numNodes * 100 : 400;
+
+    // Once the local node runs dry the other nodes are used.
+    for (i = 0; i < total; i++) {
+        objects[i] = lpx_mempool_numa_alloc(&pool);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, 48);
+    }
+    if (total == pool.numNodes * 100) {
+        assert(NULL == lpx_mempool_numa_alloc(&pool));
+    }
+
+    for (i = 0; i < total; i++) {
+        assert(0 == lpx_mempool_fixed_free(objects[i]));
+    }
+    for (i = 0; i < pool.numNodes; i++) {
+        assert(pool.nodePools[i].freeCount == 100);
+    }
+    assert(0 == lpx_mempool_destroy_numa_pool(&pool));
+    printf("Test testFixedMemPool9 passed.\n");
+}
+
+/**
+ * @brief Test lazily initialized fixed pools, creating one must not touch its memory.
+ */
+void testFixedMemPool10()
+{
+    lpx_mempool_fixed_t pool;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long size = 1000 * pageSize;
+    unsigned char resident[1000];
+    void *objects[4000];
+    void *block = NULL;
+    int modes[3] = {MEMPOOL_PROTECTED | MEMPOOL_THREAD_CACHE, MEMPOOL_UNPROTECTED, MEMPOOL_LOCKFREE};
+    pthread_t tids[4];
+    int pages = 0;
+    int i = 0;
+    int m = 0;
+
+    printf("=======================================\n");
+    block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(block != MAP_FAILED);
+    assert(0 == lpx_mempool_create_fixed_pool_from_block(&pool, 248, 4000, size, 
+                                                         MEMPOOL_PROTECTED | MEMPOOL_LAZY_INIT, block));
+    assert(0 == mincore(block, size, resident));
+    for (i = 0; i < 1000; i++) {
+        pages += resident[i] & 1;
+    }
+    assert(pages == 0);
+
+    objects[0] = lpx_mempool_fixed_alloc(&pool);
+    assert(objects[0] == (char *)block + MEMPOOL_PER_OBJECT_OVERHEAD);
+    assert(0 == lpx_mempool_fixed_free(objects[0]));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    munmap(block, size);
+
+    // Every mode has to hand out each object exactly once, bump pointer or not.
+    for (m = 0; m < 3; m++) {
+        assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 4000, modes[m] | MEMPOOL_LAZY_INIT));
+        assert(10 == lpx_mempool_fixed_alloc_bulk(&pool, objects, 10));
+        for (i = 10; i < 4000; i++) {
+            objects[i] = lpx_mempool_fixed_alloc(&pool);
+            assert(objects[i] != NULL);
+            memset(objects[i], i, 64);
+        }
+        assert(NULL == lpx_mempool_fixed_alloc(&pool));
+        assert(0 == lpx_mempool_fixed_alloc_bulk(&pool, objects, 10));
+        for (i = 0; i < 4000; i++) {
+            assert(0 == lpx_mempool_fixed_free(objects[i]));
+        }
+        assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    }
+
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 32, MEMPOOL_LOCKFREE | MEMPOOL_LAZY_INIT));
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_create(&tids[i], NULL, hammerPool, &pool));
+    }
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
+    }
+    for (i = 0; i < 32; i++) {
+        objects[i] = lpx_mempool_fixed_alloc(&pool);
+        assert(objects[i] != NULL);
+    }
+    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool10 passed.\n");
+}
+
+/**
+ * @brief Test the counters of fixed pools created with MEMPOOL_STATS.
+ */
+void testFixedMemPool11()
+{
+    lpx_mempool_fixed_t pool;
+    lpx_mempool_stats_t stats;
+    void *objects[32];
+    pthread_t tids[4];
+    int modes[3] = {MEMPOOL_PROTECTED, MEMPOOL_PROTECTED | MEMPOOL_THREAD_CACHE, MEMPOOL_LOCKFREE};
+    int i = 0;
+    int m = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 32, MEMPOOL_PROTECTED));
+    assert(-1 == lpx_mempool_fixed_get_stats(&pool, &stats));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+
+    for (m = 0; m < 3; m++) {
+        assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 32, modes[m] | MEMPOOL_STATS));
+        for (i = 0; i < 20; i++) {
+            objects[i] = lpx_mempool_fixed_alloc(&pool);
+            assert(objects[i] != NULL);
+        }
+        for (i = 0; i < 5; i++) {
+            assert(0 == lpx_mempool_fixed_free(objects[i]));
+        }
+        assert(0 == lpx_mempool_fixed_get_stats(&pool, &stats));
+        assert(stats.allocs == 20 && stats.frees == 5 && stats.failedAllocs == 0);
+        assert(stats.liveObjects == 15);
+        // Lock free pools only catch up with the high water mark when it is read.
+        assert(stats.highWaterMark >= (modes[m] == MEMPOOL_LOCKFREE ? 15 : 20));
+        assert(stats.bytesInUse == 15 * (64 + MEMPOOL_PER_OBJECT_OVERHEAD));
+        assert(stats.capacity == 32);
+
+        // Running dry counts as a failure and pushes the high water mark to the top.
+        assert(17 == lpx_mempool_fixed_alloc_bulk(&pool, objects, 17));
+        assert(NULL == lpx_mempool_fixed_alloc(&pool));
+        assert(0 == lpx_mempool_fixed_free_bulk(objects, 17));
+        assert(0 == lpx_mempool_fixed_get_stats(&pool, &stats));
+        assert(stats.allocs == 37 && stats.frees == 22 && stats.failedAllocs == 1);
+        assert(stats.highWaterMark == 32);
+        assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    }
+
+    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 32, MEMPOOL_PROTECTED | MEMPOOL_STATS));
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_create(&tids[i], NULL, hammerPool, &pool));
+    }
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
+    }
+    assert(0 == lpx_mempool_fixed_get_stats(&pool, &stats));
+    assert(stats.allocs == 4 * 100000 * 8 && stats.frees == stats.allocs);
+    assert(stats.liveObjects == 0 && stats.highWaterMark <= 32);
+    printf("Mutex contended %ld times.\n", stats.contended);
+    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
+    printf("Test testFixedMemPool11 passed.\n");
+}
+
+
+
+//---------------------------- fixed mem pool Tests ---------------------------
+
+/**
+ * @brief Sanity test for unprotected variable sized memory pools.
+ */
+void testVariableMemPool1()
+{
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    long sixM = 6L * 1024L * 1024L;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, sixM, MEMPOOL_UNPROTECTED));
+
+    object1 = lpx_mempool_variable_alloc(&pool, 64);
+    assert(NULL != object1);
+    memset(object1, 1, 64);
+
+    object2 = lpx_mempool_variable_alloc(&pool, 128);
+    assert(NULL != object2);
+    memset(object2, 2, 128);
+
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_variable_free(object2));
+
+    object1 = lpx_mempool_variable_alloc(&pool, sixM);
+    assert(NULL != object1);
+    memset(object1, 3, sixM);
+    assert(0 == lpx_mempool_variable_free(object1));
+
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool1 passed.\n");
+}
+
+/**
+ * @brief Sanity test for protected variable sized memory pools.
+ */
+void testVariableMemPool2()
+{
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    long sixM = 6L * 1024L * 1024L;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, sixM, MEMPOOL_PROTECTED));
+
+    object1 = lpx_mempool_variable_alloc(&pool, 64);
+    assert(NULL != object1);
+    memset(object1, 1, 64);
+
+    object2 = lpx_mempool_variable_alloc(&pool, 128);
+    assert(NULL != object2);
+    memset(object2, 2, 128);
+
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_variable_free(object2));
+
+    object1 = lpx_mempool_variable_alloc(&pool, sixM);
+    assert(NULL != object1);
+    memset(object1, 3, sixM);
+    assert(0 == lpx_mempool_variable_free(object1));
+
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool2 passed.\n");
+}
+
+/**
+ * @brief Test variable pools that are backed by huge pages.
+ */
+void testVariableMemPool3()
+{
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    long twoM = 2L * 1024L * 1024L;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, 1000, 
+                                                 MEMPOOL_PROTECTED | MEMPOOL_HUGEPAGES));
+    if (0 == lpx_mempool_pin_variable_pool(&pool)) {
+        assert(0 == lpx_mempool_unpin_variable_pool(&pool));
+    }
+
+    // The pool is rounded up to a whole huge page and all of it is usable.
+    object1 = lpx_mempool_variable_alloc(&pool, twoM - 2 * MEMPOOL_PER_BLOCK_OVERHEAD);
+    assert(NULL != object1);
+    memset(object1, 1, twoM - 2 * MEMPOOL_PER_BLOCK_OVERHEAD);
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool3 passed.\n");
+}
+
+/**
+ * @brief Test the counters of variable pools created with MEMPOOL_STATS.
+ */
+void testVariableMemPool4()
+{
+    lpx_mempool_variable_t pool;
+    lpx_mempool_stats_t stats;
+    char *object1 = NULL;
+    char *object2 = NULL;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, 4096, MEMPOOL_PROTECTED | MEMPOOL_STATS));
+    object1 = lpx_mempool_variable_alloc(&pool, 96);
+    object2 = lpx_mempool_variable_alloc(&pool, 200);
+    assert(object1 != NULL && object2 != NULL);
+    assert(NULL == lpx_mempool_variable_alloc(&pool, 8192));
+
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.allocs == 2 && stats.frees == 0 && stats.failedAllocs == 1);
+    assert(stats.liveObjects == 2 && stats.highWaterMark == 2);
+    assert(stats.bytesInUse >= 296 + 2 * MEMPOOL_PER_BLOCK_OVERHEAD);
+    assert(stats.capacity == 4096 + MEMPOOL_PER_BLOCK_OVERHEAD);
+
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_variable_free(object2));
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.liveObjects == 0 && stats.highWaterMark == 2 && stats.bytesInUse == 0);
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool4 passed.\n");
+}
+
+/**
+ * @brief Churn a variable pool with odd sizes, everything has to coalesce back into
+ *        one block once it is all freed.
+ * @param pool A fresh pool of size bytes.
+ * @param size The size the pool was created with.
+ */
+void churnVariablePool(lpx_mempool_variable_t *pool, long size)
+{
+    char *objects[1000];
+    int round = 0;
+    int i = 0;
+
+    for (i = 0; i < 1000; i++) {
+        objects[i] = lpx_mempool_variable_alloc(pool, (i * 37) % 700 + 1);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, (i * 37) % 700 + 1);
+    }
+
+    // Punch holes and fill them with different sizes a few times over.
+    for (round = 1; round < 4; round++) {
+        for (i = round % 2; i < 1000; i += 2) {
+            assert(objects[i][0] == (char)(i * round));
+            assert(0 == lpx_mempool_variable_free(objects[i]));
+        }
+        for (i = round % 2; i < 1000; i += 2) {
+            objects[i] = lpx_mempool_variable_alloc(pool, (i * 13 * round) % 500 + 3);
+            assert(objects[i] != NULL);
+            memset(objects[i], i * (round + 1), (i * 13 * round) % 500 + 3);
+        }
+        for (i = (round + 1) % 2; i < 1000; i += 2) {
+            memset(objects[i], i * (round + 1), 1);
+        }
+    }
+
+    assert(NULL == lpx_mempool_variable_alloc(pool, size));
+    for (i = 0; i < 1000; i++) {
+        assert(0 == lpx_mempool_variable_free(objects[i]));
+    }
+    objects[0] = lpx_mempool_variable_alloc(pool, size);
+    assert(objects[0] != NULL);
+    assert(0 == lpx_mempool_variable_free(objects[0]));
+}
+
+/**
+ * @brief Churn test for variable pools.
+ */
+void testVariableMemPool5()
+{
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    long oneM = 1024L * 1024L;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, oneM, MEMPOOL_PROTECTED));
+    churnVariablePool(&pool, oneM);
+
+    // The block is tagged as free, so freeing it again is caught.
+    object1 = lpx_mempool_variable_alloc(&pool, 100);
+    assert(object1 != NULL);
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(-1 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool5 passed.\n");
+}
+
+/**
+ * @brief Test variable pools created with MEMPOOL_TLSF.
+ */
+void testVariableMemPool6()
+{
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    char *object3 = NULL;
+    long oneM = 1024L * 1024L;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, oneM, MEMPOOL_PROTECTED | MEMPOOL_TLSF));
+    churnVariablePool(&pool, oneM);
+
+    // Freeing the middle block last has to merge it with both of its neighbours.
+    object1 = lpx_mempool_variable_alloc(&pool, 1000);
+    object2 = lpx_mempool_variable_alloc(&pool, 2000);
+    object3 = lpx_mempool_variable_alloc(&pool, 3000);
+    assert(object1 != NULL && object2 != NULL && object3 != NULL);
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_variable_free(object3));
+    assert(-1 == lpx_mempool_variable_free(object3));
+    assert(0 == lpx_mempool_variable_free(object2));
+    object1 = lpx_mempool_variable_alloc(&pool, oneM);
+    assert(object1 != NULL);
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool6 passed.\n");
+}
+
+/**
+ * @brief Test lpx_mempool_variable_realloc, in place and moving.
+ */
+void testVariableMemPool7()
+{
+    lpx_mempool_variable_t pool;
+    lpx_mempool_variable_t other;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    char *object3 = NULL;
+    char *object4 = NULL;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_variable_pool(&pool, 64 * 1024, MEMPOOL_PROTECTED));
+    assert(0 == lpx_mempool_create_variable_pool(&other, 4096, MEMPOOL_UNPROTECTED | MEMPOOL_TLSF));
+    object1 = lpx_mempool_variable_realloc(&pool, NULL, 100);
+    object2 = lpx_mempool_variable_alloc(&pool, 1000);
+    object3 = lpx_mempool_variable_alloc(&pool, 100);
+    assert(object1 != NULL && object2 != NULL && object3 != NULL);
+    memset(object2, 2, 1000);
+    assert(NULL == lpx_mempool_variable_realloc(&other, object2, 10));
+
+    // Shrinking and then growing back stays in place.
+    assert(object2 == lpx_mempool_variable_realloc(&pool, object2, 200));
+    object4 = lpx_mempool_variable_alloc(&pool, 500);
+    assert(object4 == object2 + 200 + MEMPOOL_PER_BLOCK_OVERHEAD);
+    assert(0 == lpx_mempool_variable_free(object4));
+    assert(object2 == lpx_mempool_variable_realloc(&pool, object2, 900));
+    for (i = 0; i < 200; i++) {
+        assert(object2[i] == 2);
+    }
+
+    // object2 follows object1, so growing object1 moves it.
+    memset(object1, 1, 100);
+    object4 = lpx_mempool_variable_realloc(&pool, object1, 5000);
+    assert(object4 != NULL && object4 != object1);
+    for (i = 0; i < 100; i++) {
+        assert(object4[i] == 1);
+    }
+    assert(NULL == lpx_mempool_variable_realloc(&pool, object4, 1024 * 1024));
+    assert(object4[99] == 1);
+
+    assert(0 == lpx_mempool_variable_free(object2));
+    assert(0 == lpx_mempool_variable_free(object3));
+    assert(0 == lpx_mempool_variable_free(object4));
+    object1 = lpx_mempool_variable_alloc(&pool, 64 * 1024);
+    assert(object1 != NULL);
+    assert(0 == lpx_mempool_variable_free(object1));
+
+    // A TLSF pool resizes the same way.
+    object1 = lpx_mempool_variable_alloc(&other, 10);
+    assert(object1 != NULL);
+    assert(object1 == lpx_mempool_variable_realloc(&other, object1, 4000));
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(NULL != (object1 = lpx_mempool_variable_alloc(&other, 4096)));
+    assert(0 == lpx_mempool_variable_free(object1));
+
+    assert(0 == lpx_mempool_destroy_variable_pool(&other));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool7 passed.\n");
+}
+
+/**
+ * @brief Test lpx_mempool_variable_memalign in both engines.
+ */
+void testVariableMemPool8()
+{
+    lpx_mempool_variable_t pool;
+    char *block = NULL;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    char *object3 = NULL;
+    int flags[2] = {MEMPOOL_UNPROTECTED, MEMPOOL_PROTECTED | MEMPOOL_TLSF};
+    long alignment = 0;
+    int i = 0;
+
+    printf("=======================================\n");
+    assert(0 == posix_memalign((void **)&block, 4096, 64 * 1024));
+    for (i = 0; i < 2; i++) {
+        // Start the pool off a page boundary, so there is slack in front of the object.
+        assert(0 == lpx_mempool_create_variable_pool_from_block(&pool, 60 * 1024, flags[i],
+                                                                 block + 64));
+        assert(NULL == lpx_mempool_variable_memalign(&pool, 48, 100));
+        object1 = lpx_mempool_variable_memalign(&pool, 4096, 100);
+        assert(object1 != NULL && ((long)object1 & 4095) == 0);
+        memset(object1, 1, 100);
+
+        // The slack is a free block, so it is used for what comes next.
+        object2 = lpx_mempool_variable_alloc(&pool, 100);
+        assert(object2 != NULL && object2 < object1);
+        memset(object2, 2, 100);
+
+        for (alignment = 8; alignment <= 8192; alignment *= 2) {
+            object3 = lpx_mempool_variable_memalign(&pool, alignment, 1000);
+            assert(object3 != NULL && ((long)object3 & (alignment - 1)) == 0);
+            memset(object3, 3, 1000);
+            assert(0 == lpx_mempool_variable_free(object3));
+        }
+        assert(object1[0] == 1 && object1[99] == 1 && object2[0] == 2 && object2[99] == 2);
+
+        assert(0 == lpx_mempool_variable_free(object1));
+        assert(0 == lpx_mempool_variable_free(object2));
+        object1 = lpx_mempool_variable_alloc(&pool, 60 * 1024 - MEMPOOL_PER_BLOCK_OVERHEAD -
+                                             VPMD_END_SIZE);
+        assert(object1 != NULL);
+        assert(0 == lpx_mempool_variable_free(object1));
+        assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    }
+    free(block);
+    printf("Test testVariableMemPool8 passed.\n");
+}
+
+/**
+ * @brief Test the fragmentation report of variable pools.
+ */
+void testVariableMemPool9()
+{
+    lpx_mempool_variable_t pool;
+    lpx_mempool_frag_t frag;
+    char *objects[10];
+    int flags[2] = {MEMPOOL_PROTECTED, MEMPOOL_UNPROTECTED | MEMPOOL_TLSF};
+    long oneM = 1024L * 1024L;
+    int i = 0;
+    int j = 0;
+
+    printf("=======================================\n");
+    for (j = 0; j < 2; j++) {
+        assert(0 == lpx_mempool_create_variable_pool(&pool, oneM, flags[j]));
+        assert(0 == lpx_mempool_variable_get_fragmentation(&pool, &frag));
+        assert(frag.freeBlocks == 1 && frag.histogram[20] == 1);
+        assert(frag.freeBytes == oneM + MEMPOOL_PER_BLOCK_OVERHEAD);
+        assert(frag.largestFree == frag.freeBytes);
+
+        // Every other object leaves a hole of 1016 bytes.
+        for (i = 0; i < 10; i++) {
+            objects[i] = lpx_mempool_variable_alloc(&pool, 1000);
+            assert(objects[i] != NULL);
+        }
+        for (i = 0; i < 10; i += 2) {
+            assert(0 == lpx_mempool_variable_free(objects[i]));
+        }
+        assert(0 == lpx_mempool_variable_get_fragmentation(&pool, &frag));
+        assert(frag.freeBlocks == 6 && frag.histogram[9] == 5 && frag.histogram[19] == 1);
+        assert(frag.freeBytes == oneM + MEMPOOL_PER_BLOCK_OVERHEAD - 5 * 1016);
+        assert(frag.largestFree == oneM + MEMPOOL_PER_BLOCK_OVERHEAD - 10 * 1016);
+
+        for (i = 1; i < 10; i += 2) {
+            assert(0 == lpx_mempool_variable_free(objects[i]));
+        }
+        assert(0 == lpx_mempool_variable_get_fragmentation(&pool, &frag));
+        assert(frag.freeBlocks == 1 && frag.largestFree == oneM + MEMPOOL_PER_BLOCK_OVERHEAD);
+        assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    }
+    printf("Test testVariableMemPool9 passed.\n");
+}
+
+/**
+ * @brief Test variable pools that grow with extents, and giving the memory back.
  */
-#define BARRIERTEST1_NUM_THREADS	4
+void testVariableMemPool10()
+{
+    lpx_mempool_variable_t pool;
+    char *objects[7];
+    int flags[2] = {MEMPOOL_PROTECTED, MEMPOOL_UNPROTECTED | MEMPOOL_TLSF};
+    long size = 100 * 1024;
+    long capacity = 0;
+    int i = 0;
+    int j = 0;
 
-char barrierOutArray[BARRIERTEST1_NUM_ITERATIONS * BARRIERTEST1_NUM_THREADS]; /**< Output array for barrierTest1 threads. */
-pthread_mutex_t barrierTest1Mutex;  /**< Mutex to protect barrierOutArray */
-int barrierTest1Index;   /**< Current index to write to in barrierOutArray */
+    printf("=======================================\n");
+    for (j = 0; j < 2; j++) {
+        assert(0 == lpx_mempool_create_variable_pool(&pool, 64 * 1024, flags[j]));
+        capacity = pool.capacity;
+        assert(NULL == lpx_mempool_variable_alloc(&pool, size));
+        objects[0] = lpx_mempool_variable_alloc(&pool, 60 * 1024);
+        memset(objects[0], 1, 60 * 1024);
+        assert(0 == lpx_mempool_variable_free(objects[0]));
+        assert(-1 == lpx_mempool_set_variable_pool_growth(&pool, -1, 0));
+        assert(0 == lpx_mempool_set_variable_pool_growth(&pool, 256 * 1024, 1024 * 1024));
+
+        // Two objects fit an extent, and only three extents fit under the limit.
+        for (i = 0; i < 7; i++) {
+            objects[i] = lpx_mempool_variable_alloc(&pool, size);
+            if (objects[i] != NULL) {
+                memset(objects[i], i, size);
+            }
+        }
+        assert(objects[5] != NULL && objects[6] == NULL);
+        assert(pool.capacity > capacity + 3 * 255 * 1024 && pool.capacity <= 1024 * 1024);
+
+        // Only the extent that still holds an object stays mapped.
+        for (i = 0; i < 6; i++) {
+            if (i != 1) {
+                assert(0 == lpx_mempool_variable_free(objects[i]));
+            }
+        }
+        assert(0 == lpx_mempool_purge_variable_pool(&pool, 0));
+        assert(pool.extents != NULL && pool.extents->next == NULL);
+        assert(objects[1][0] == 1 && objects[1][size - 1] == 1);
+        assert(0 == lpx_mempool_variable_free(objects[1]));
+        assert(0 == lpx_mempool_purge_variable_pool(&pool, 0));
+        assert(pool.extents == NULL && pool.capacity == capacity);
+
+        // A request larger than an extent gets one of its own, the purged pages come
+        // back as zeros.
+        assert(0 == lpx_mempool_set_variable_pool_growth(&pool, 256 * 1024, 0));
+        objects[0] = lpx_mempool_variable_alloc(&pool, 1024 * 1024);
+        assert(objects[0] != NULL);
+        memset(objects[0], 1, 1024 * 1024);
+        objects[1] = lpx_mempool_variable_alloc(&pool, 60 * 1024);
+        assert(objects[1] != NULL && objects[1][32 * 1024] == 0);
+        assert(0 == lpx_mempool_variable_free(objects[1]));
+        assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    }
+    printf("Test testVariableMemPool10 passed.\n");
+}
 
 /**
- * @brief Test function for barriers.
- * @param arg Will hold the barrier that we need to synchronize on.
- * @return Ignored.
+ * @brief  Allocate objects from a pool with arenas for the caller to free.
+ * @param  arg An array of 64 objects with the pool in the first one.
+ * @return Always NULL.
  */
-void *barrierTest(void *arg)
+void *fillArena(void *arg)
 {
+    void **objects = (void **)arg;
+    lpx_mempool_variable_t *pool = (lpx_mempool_variable_t *)objects[0];
     int i = 0;
-    lpx_barrier_t *barrier = (lpx_barrier_t *)arg;
-    for(i = 0; i < BARRIERTEST1_NUM_ITERATIONS; i++) {
-        pthread_mutex_lock(&barrierTest1Mutex);
-	barrierOutArray[barrierTest1Index++] = i;
-	pthread_mutex_unlock(&barrierTest1Mutex);
-	
-	lpx_barrier_sync(barrier);
+
+    for (i = 0; i < 64; i++) {
+        objects[i] = lpx_mempool_variable_alloc(pool, 100 + i);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, 100 + i);
     }
     return NULL;
 }
 
 /**
- * @brief Test case for barriers.
+ * @brief Test variable pools with arenas, every thread should get an arena of its
+ *        own and objects should go back to their arena from any thread.
  */
-void testBarrier1()
+void testVariableMemPool11()
 {
+    lpx_mempool_variable_t pool;
+    lpx_mempool_stats_t stats;
+    lpx_mempool_frag_t frag;
+    void *objects[4][64];
+    void *owners[4];
+    pthread_t tids[4];
     int i = 0;
-    int n = 0;
-    int index = 0;
-    int *retval = NULL;
-    lpx_thread_future_t *future[BARRIERTEST1_NUM_THREADS];
-    lpx_barrier_t barrier;
-
-    barrierTest1Index = 0;
-    pthread_mutex_init(&barrierTest1Mutex, NULL);
-
-    lpx_threadpool_t *pool = lpx_threadpool_init(BARRIERTEST1_NUM_THREADS, \
-                                           BARRIERTEST1_NUM_THREADS, THREAD_POOL_FIXED);
-    assert(pool != NULL);
+    int j = 0;
 
-    assert(0 == lpx_create_barrier(&barrier, BARRIERTEST1_NUM_THREADS));
     printf("=======================================\n");
+    assert(-1 == lpx_mempool_create_variable_pool_with_arenas(&pool, 64 * 1024,
+                                                              MEMPOOL_PROTECTED, -1));
+    assert(0 == lpx_mempool_create_variable_pool_with_arenas(&pool, 64 * 1024,
+                                                             MEMPOOL_PROTECTED, 0));
+    assert(pool.numArenas == sysconf(_SC_NPROCESSORS_ONLN));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
 
-    for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
-        future[i] = lpx_threadpool_execute(pool, barrierTest, (void *)&barrier);
-        assert (future[i] != NULL);
+    assert(0 == lpx_mempool_create_variable_pool_with_arenas(&pool, 64 * 1024,
+                                                             MEMPOOL_PROTECTED | MEMPOOL_STATS,
+                                                             4));
+    for (i = 0; i < 4; i++) {
+        objects[i][0] = &pool;
+        assert(0 == pthread_create(&tids[i], NULL, fillArena, objects[i]));
     }
-
-    for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
-        assert(0 == lpx_threadpool_join(future[i], (void **)&retval));
+    for (i = 0; i < 4; i++) {
+        assert(0 == pthread_join(tids[i], NULL));
     }
 
-    for (n = 0; n < BARRIERTEST1_NUM_ITERATIONS; n++) {
-        for (i = 0; i < BARRIERTEST1_NUM_THREADS; i++) {
-            assert(barrierOutArray[index++] == n);
+    for (i = 0; i < 4; i++) {
+        owners[i] = (void *)((long *)objects[i][0])[-2];
+        for (j = 0; j < i; j++) {
+            assert(owners[i] != owners[j]);
+        }
+        for (j = 0; j < 64; j++) {
+            assert((void *)((long *)objects[i][j])[-2] == owners[i]);
+            assert(((char *)objects[i][j])[99] == j);
         }
     }
-
-    assert(0 == lpx_threadpool_destroy(pool));
-    assert(0 == lpx_destroy_barrier(&barrier));
-    printf("Test testBarrier1 passed.\n");
-    return;
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.allocs == 256 && stats.liveObjects == 256);
+    assert(stats.capacity == 4 * (64 * 1024 + MEMPOOL_PER_BLOCK_OVERHEAD));
+
+    // Objects of other arenas are resized in place and freed into their own arena.
+    for (i = 0; i < 4; i++) {
+        assert(objects[i][10] == lpx_mempool_variable_realloc(&pool, objects[i][10], 50));
+        for (j = 0; j < 64; j++) {
+            assert(0 == lpx_mempool_variable_free(objects[i][j]));
+        }
+    }
+    assert(0 == lpx_mempool_variable_get_fragmentation(&pool, &frag));
+    assert(frag.freeBlocks == 4 && frag.freeBytes == stats.capacity);
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.frees == 256 && stats.liveObjects == 0);
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool11 passed.\n");
 }
 
+/**
+ * @brief  Read how much memory the process has locked.
+ * @return VmLck in kilobytes, -1 if it could not be read.
+ */
+long lockedKilobytes()
+{
+    char line[256];
+    long locked = -1;
+    FILE *status = fopen("/proc/self/status", "r");
 
-//---------------------------- fixed mem pool Tests ---------------------------
+    if (status == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (1 == sscanf(line, "VmLck: %ld kB", &locked)) {
+            break;
+        }
+    }
+    fclose(status);
+    return locked;
+}
 
 /**
- * @brief Sanity test for the unprotected fixed sized memory pools.
+ * @brief Test that pinning a growable variable pool pins its extents too.
  */
-void testFixedMemPool1()
+void testVariableMemPool12()
 {
-    lpx_mempool_fixed_t pool;
-    char *object1;
-    char *object2;
+    lpx_mempool_variable_t pool;
+    char *object1 = NULL;
+    char *object2 = NULL;
+    long locked = 0;
 
     printf("=======================================\n");
-    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 2, MEMPOOL_UNPROTECTED));
-    object1 = lpx_mempool_fixed_alloc(&pool);
+    assert(0 == lpx_mempool_create_variable_pool(&pool, 64 * 1024, MEMPOOL_PROTECTED));
+    assert(0 == lpx_mempool_set_variable_pool_growth(&pool, 256 * 1024, 0));
+    object1 = lpx_mempool_variable_alloc(&pool, 100 * 1024);
     assert(object1 != NULL);
-    memset(object1, 0, 64);
-    
-    object2 = lpx_mempool_fixed_alloc(&pool);
-    assert(object2 != NULL);
-    memset(object2, 1, 64);
-
-    assert(NULL == lpx_mempool_fixed_alloc(&pool));
-    assert(0 == lpx_mempool_fixed_free(object1));
-    assert(0 == lpx_mempool_fixed_free(object2));
 
-    assert(NULL != lpx_mempool_fixed_alloc(&pool));
-    assert(NULL != lpx_mempool_fixed_alloc(&pool));
-    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    // Pinning is subject to RLIMIT_MEMLOCK, skip the checks if it is too low.
+    if (0 == lpx_mempool_pin_variable_pool(&pool) && (locked = lockedKilobytes()) >= 0) {
+        assert(locked >= 64 + 256);
+
+        // An extent mapped while the pool is pinned is pinned right away.
+        object2 = lpx_mempool_variable_alloc(&pool, 200 * 1024);
+        assert(object2 != NULL);
+        assert(lockedKilobytes() >= locked + 256);
+        memset(object2, 1, 200 * 1024);
+
+        // Purging a pinned pool only gives back idle extents.
+        assert(0 == lpx_mempool_variable_free(object2));
+        assert(0 == lpx_mempool_purge_variable_pool(&pool, 0));
+        assert(lockedKilobytes() >= locked && lockedKilobytes() < locked + 256);
+        assert(0 == lpx_mempool_unpin_variable_pool(&pool));
+        assert(lockedKilobytes() < locked);
+    }
 
-    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
-    printf("Test testFixedMemPool1 passed.\n");
-    return;
+    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+    printf("Test testVariableMemPool12 passed.\n");
 }
 
 /**
- * @brief Sanity check the protected fixed sized memory pools.
+ * @brief Test shared pools, a child process fills in objects and passes their offsets
+ *        back to the parent, which reads and frees them.
  */
-void testFixedMemPool2()
+void testSharedMemPool1()
 {
-    lpx_mempool_fixed_t pool;
-    char *object1;
-    char *object2;
+    lpx_mempool_shared_t pool;
+    lpx_mempool_shared_t other;
+    char name[64];
+    char expected[32];
+    char *object = NULL;
+    long offsets[10];
+    int fds[2];
+    int status = 0;
+    pid_t child = 0;
+    int i = 0;
 
     printf("=======================================\n");
-    assert(0 == lpx_mempool_create_fixed_pool(&pool, 64, 2, MEMPOOL_PROTECTED));
-    object1 = lpx_mempool_fixed_alloc(&pool);
-    assert(object1 != NULL);
-    memset(object1, 0, 64);
-    
-    object2 = lpx_mempool_fixed_alloc(&pool);
-    assert(object2 != NULL);
-    memset(object2, 1, 64);
-
-    assert(NULL == lpx_mempool_fixed_alloc(&pool));
-    assert(0 == lpx_mempool_fixed_free(object1));
-    assert(0 == lpx_mempool_fixed_free(object2));
+    snprintf(name, sizeof(name), "/lpx_test_%d", (int)getpid());
+    assert(0 == lpx_mempool_create_shared_pool(&pool, name, 100, 10));
+    assert(-1 == lpx_mempool_create_shared_pool(&other, name, 100, 10));
+    assert(0 == pipe(fds));
+
+    child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+        // The child opens the pool by name and maps it at an address of its own.
+        if (0 != lpx_mempool_open_shared_pool(&other, name)) {
+            _exit(1);
+        }
+        for (i = 0; i < 10; i++) {
+            object = lpx_mempool_shared_alloc(&other);
+            if (object == NULL) {
+                _exit(2);
+            }
+            snprintf(object, 100, "message %d", i);
+            offsets[i] = lpx_mempool_shared_offset(&other, object);
+        }
+        if (NULL != lpx_mempool_shared_alloc(&other)) {
+            _exit(3);
+        }
+        if (sizeof(offsets) != write(fds[1], offsets, sizeof(offsets))) {
+            _exit(4);
+        }
+        lpx_mempool_close_shared_pool(&other);
+        _exit(0);
+    }
 
-    assert(NULL != lpx_mempool_fixed_alloc(&pool));
-    assert(NULL != lpx_mempool_fixed_alloc(&pool));
-    assert(NULL == lpx_mempool_fixed_alloc(&pool));
+    assert(sizeof(offsets) == read(fds[0], offsets, sizeof(offsets)));
+    assert(child == waitpid(child, &status, 0));
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(fds[0]);
+    close(fds[1]);
 
-    assert(0 == lpx_mempool_destroy_fixed_pool(&pool));
-    printf("Test testFixedMemPool2 passed.\n");
+    for (i = 0; i < 10; i++) {
+        object = lpx_mempool_shared_address(&pool, offsets[i]);
+        assert(object != NULL);
+        snprintf(expected, sizeof(expected), "message %d", i);
+        assert(0 == strcmp(object, expected));
+        assert(0 == lpx_mempool_shared_free(&pool, object));
+        assert(-1 == lpx_mempool_shared_free(&pool, object));
+    }
+    for (i = 0; i < 10; i++) {
+        assert(NULL != lpx_mempool_shared_alloc(&pool));
+    }
+    assert(NULL == lpx_mempool_shared_alloc(&pool));
+    assert(0 == lpx_mempool_destroy_shared_pool(&pool));
+    printf("Test testSharedMemPool1 passed.\n");
 }
 
-
-
-//---------------------------- fixed mem pool Tests ---------------------------
-
 /**
- * @brief Sanity test for unprotected variable sized memory pools.
+ * @brief Sanity test for sized pools, every size has to land in a block that fits it.
  */
-void testVariableMemPool1()
+void testSizedMemPool1()
 {
-    lpx_mempool_variable_t pool;
-    char *object1 = NULL;
-    char *object2 = NULL;
-    long sixM = 6L * 1024L * 1024L;
+    lpx_mempool_sized_t pool;
+    char *objects[5000];
+    int i = 0;
 
     printf("=======================================\n");
-    assert(0 == lpx_mempool_create_variable_pool(&pool, sixM, MEMPOOL_UNPROTECTED));
-
-    object1 = lpx_mempool_variable_alloc(&pool, 64);
-    assert(NULL != object1);
-    memset(object1, 1, 64);
-
-    object2 = lpx_mempool_variable_alloc(&pool, 128);
-    assert(NULL != object2);
-    memset(object2, 2, 128);
-
-    assert(0 == lpx_mempool_variable_free(object1));
-    assert(0 == lpx_mempool_variable_free(object2));
-
-    object1 = lpx_mempool_variable_alloc(&pool, sixM);
-    assert(NULL != object1);
-    memset(object1, 3, sixM);
-    assert(0 == lpx_mempool_variable_free(object1));
+    assert(0 == lpx_mempool_create_sized_pool(&pool, 0, MEMPOOL_UNPROTECTED));
+    assert(NULL != (objects[0] = lpx_mempool_sized_alloc(&pool, MEMPOOL_SIZED_MAX_SMALL)));
+    assert(NULL == lpx_mempool_sized_alloc(&pool, MEMPOOL_SIZED_MAX_SMALL + 1));
+    assert(0 == lpx_mempool_sized_free(&pool, objects[0]));
+    assert(0 == lpx_mempool_destroy_sized_pool(&pool));
+
+    assert(0 == lpx_mempool_create_sized_pool(&pool, 8 * 1024 * 1024, 
+                                              MEMPOOL_PROTECTED | MEMPOOL_THREAD_CACHE));
+    for (i = 0; i < 5000; i++) {
+        objects[i] = lpx_mempool_sized_alloc(&pool, i);
+        assert(objects[i] != NULL);
+        memset(objects[i], i, i);
+    }
+    for (i = 0; i < 5000; i++) {
+        assert(i < 2 || (objects[i][0] == (char)i && objects[i][i - 1] == (char)i));
+        assert(0 == lpx_mempool_sized_free(&pool, objects[i]));
+    }
 
-    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
-    printf("Test testVariableMemPool1 passed.\n");
+    // Small sizes come from a size class, so the block does not move when it is reused.
+    objects[0] = lpx_mempool_sized_alloc(&pool, 24);
+    assert(0 == lpx_mempool_sized_free(&pool, objects[0]));
+    assert(objects[0] == lpx_mempool_sized_alloc(&pool, 32));
+    assert(0 == lpx_mempool_sized_free(&pool, objects[0]));
+    assert(0 == lpx_mempool_destroy_sized_pool(&pool));
+    printf("Test testSizedMemPool1 passed.\n");
 }
 
 /**
- * @brief Sanity test for protected variable sized memory pools.
+ * @brief Test lpx_mempool_sized_realloc across size classes and the variable pool.
  */
-void testVariableMemPool2()
+void testSizedMemPool2()
 {
-    lpx_mempool_variable_t pool;
+    lpx_mempool_sized_t pool;
     char *object1 = NULL;
     char *object2 = NULL;
-    long sixM = 6L * 1024L * 1024L;
+    int i = 0;
 
     printf("=======================================\n");
-    assert(0 == lpx_mempool_create_variable_pool(&pool, sixM, MEMPOOL_PROTECTED));
-
-    object1 = lpx_mempool_variable_alloc(&pool, 64);
-    assert(NULL != object1);
-    memset(object1, 1, 64);
-
-    object2 = lpx_mempool_variable_alloc(&pool, 128);
-    assert(NULL != object2);
-    memset(object2, 2, 128);
-
-    assert(0 == lpx_mempool_variable_free(object1));
-    assert(0 == lpx_mempool_variable_free(object2));
+    assert(0 == lpx_mempool_create_sized_pool(&pool, 1024 * 1024, MEMPOOL_UNPROTECTED));
+    object1 = lpx_mempool_sized_realloc(&pool, NULL, 20);
+    assert(object1 != NULL);
+    memset(object1, 1, 20);
 
-    object1 = lpx_mempool_variable_alloc(&pool, sixM);
-    assert(NULL != object1);
-    memset(object1, 3, sixM);
-    assert(0 == lpx_mempool_variable_free(object1));
+    // Still the same size class.
+    assert(object1 == lpx_mempool_sized_realloc(&pool, object1, 32));
 
-    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
-    printf("Test testVariableMemPool2 passed.\n");
+    for (i = 0; i < 7; i++) {
+        object2 = lpx_mempool_sized_realloc(&pool, object1, 100L << (2 * i));
+        assert(object2 != NULL);
+        assert(object2[0] == 1 && object2[19] == 1);
+        object1 = object2;
+    }
+    object2 = lpx_mempool_sized_realloc(&pool, object1, 10);
+    assert(object2 != NULL && object2 != object1);
+    assert(object2[0] == 1 && object2[9] == 1);
+    assert(0 == lpx_mempool_sized_free(&pool, object2));
+    assert(0 == lpx_mempool_destroy_sized_pool(&pool));
+    printf("Test testSizedMemPool2 passed.\n");
 }
 
 #define BASEF_SIZE		4096
@@ -488,16 +1900,16 @@ void testVariableMemPool2()
  */
 void runTests(void *baseF, void *baseV) 
 {
-    void *fobjects[31];
+    void *fobjects[30];
     void *vobjects[10];
     int i = 0;
 
     // Create a fixed pool from baseF
     lpx_mempool_fixed_t fpool;
-    assert(0 == lpx_mempool_create_fixed_pool_from_block(&fpool, 128, 31, BASEF_SIZE, MEMPOOL_UNPROTECTED, baseF));
+    assert(0 == lpx_mempool_create_fixed_pool_from_block(&fpool, 128, 30, BASEF_SIZE, MEMPOOL_UNPROTECTED, baseF));
 
     // Allocate a bunch of stuff from the fixed pool.
-    for (i = 0; i < 31; i++) {
+    for (i = 0; i < 30; i++) {
         fobjects[i] = lpx_mempool_fixed_alloc(&fpool);
 	assert(NULL != fobjects[i]);
 	memset(fobjects[i], 0, 128);
@@ -515,7 +1927,7 @@ void runTests(void *baseF, void *baseV)
     }
 
     // Deallocate fixed.
-    for (i = 0; i < 31; i++) {
+    for (i = 0; i < 30; i++) {
         lpx_mempool_fixed_free(fobjects[i]);
     }
 
@@ -881,6 +2293,36 @@ void testTreemapWorstCaseWithPools()
     printf("Test testTreemapWorstCaseWithPools passed.\n");
 }
 
+/**
+ * @brief Test the treemap with a sized pool.
+ */
+void testTreemapWorstCaseWithSizedPools()
+{
+    lpx_treemap_t treemap;
+    lpx_mempool_sized_t pool;
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_sized_pool(&pool, 0, MEMPOOL_UNPROTECTED));
+    
+    assert(0 == lpx_treemap_init_from_sized_pool(&treemap, TREEMAP_UNPROTECTED, &pool));
+    treeTest1(&treemap);
+    assert(0 == lpx_treemap_destroy(&treemap));
+
+    assert(0 == lpx_treemap_init_from_sized_pool(&treemap, TREEMAP_PROTECTED, &pool));
+    treeTest2(&treemap);
+    assert(0 == lpx_treemap_destroy(&treemap));
+    
+    assert(0 == lpx_treemap_init_from_sized_pool(&treemap, TREEMAP_UNPROTECTED, &pool));
+    treeTest3(&treemap);
+    assert(0 == lpx_treemap_destroy(&treemap));
+
+    assert(0 == lpx_treemap_init_from_sized_pool(&treemap, TREEMAP_UNPROTECTED, &pool));
+    treeTest4(&treemap);
+    assert(0 == lpx_treemap_destroy(&treemap));
+
+    assert(0 == lpx_mempool_destroy_sized_pool(&pool));
+    printf("Test testTreemapWorstCaseWithSizedPools passed.\n");
+}
+
 // ------------------------------- Test the arraylist ----------------------------
 
 /**
@@ -983,7 +2425,7 @@ void listToArrayTest(lpx_arraylist_t *list)
         assert(array[i] == i * 1000);
     }
 
-    if (list->pool == NULL) {
+    if (list->pool == NULL && list->sizedPool == NULL) {
         free(array);
     }
 
@@ -1049,6 +2491,148 @@ void testArraylistPools()
     printf("Test testArraylistPools passed.\n");
 }
 
+/**
+ * @brief Test the arraylist with a sized pool, the larger arrays go to its variable pool.
+ */
+void testArraylistSizedPools()
+{
+    lpx_arraylist_t list;
+    lpx_mempool_sized_t pool;
+    printf("=======================================\n");
+    assert(0 == lpx_mempool_create_sized_pool(&pool, 1024 * 1024, MEMPOOL_PROTECTED));
+    
+    assert(0 == lpx_arraylist_init_from_sized_pool(&list, ARRAYLIST_PROTECTED, &pool));
+    listInsertTest(&list);
+    assert(0 == lpx_arraylist_destroy(&list));
+    
+    assert(0 == lpx_arraylist_init_from_sized_pool(&list, ARRAYLIST_PROTECTED, &pool));
+    listRemoveTest(&list);
+    assert(0 == lpx_arraylist_destroy(&list));
+    
+    assert(0 == lpx_arraylist_init_from_sized_pool(&list, ARRAYLIST_PROTECTED, &pool));
+    clearListTest(&list);
+    assert(0 == lpx_arraylist_destroy(&list));
+    
+    assert(0 == lpx_arraylist_init_from_sized_pool(&list, ARRAYLIST_PROTECTED, &pool));
+    listToArrayTest(&list);
+    assert(0 == lpx_arraylist_destroy(&list));
+    
+    assert(0 == lpx_arraylist_init_from_sized_pool(&list, ARRAYLIST_PROTECTED, &pool));
+    getIndexTest(&list);
+    assert(0 == lpx_arraylist_destroy(&list));
+    
+    assert(0 == lpx_mempool_destroy_sized_pool(&pool));
+    printf("Test testArraylistSizedPools passed.\n");
+}
+
+/**
+ * @brief Fill an arena with a request's worth of objects, then release them.
+ * @param arena The arena to use.
+ * @param maxSize The largest object to allocate.
+ */
+void arenaTest(lpx_arena_t *arena, long maxSize)
+{
+    lpx_arena_mark_t mark;
+    char *objects[200];
+    char *object = NULL;
+    int i = 0;
+
+    object = lpx_arena_alloc(arena, 10);
+    assert(object != NULL);
+    memset(object, 7, 10);
+
+    assert(0 == lpx_arena_mark(arena, &mark));
+    for (i = 0; i < 200; i++) {
+        objects[i] = lpx_arena_alloc(arena, (i * 31) % maxSize + 1);
+        assert(objects[i] != NULL);
+        assert(((long)objects[i] & (sizeof(long) - 1)) == 0);
+        memset(objects[i], i, (i * 31) % maxSize + 1);
+    }
+    for (i = 0; i < 200; i++) {
+        assert(objects[i][0] == (char)i && objects[i][(i * 31) % maxSize] == (char)i);
+    }
+
+    // Going back to the mark hands out the same memory again.
+    assert(0 == lpx_arena_release_to_mark(arena, &mark));
+    assert(object[9] == 7);
+    assert(objects[0] == lpx_arena_alloc(arena, 1));
+
+    assert(0 == lpx_arena_reset(arena));
+    assert(object == lpx_arena_alloc(arena, 10));
+}
+
+/**
+ * @brief Test arenas on malloc, a variable pool and a fixed pool.
+ */
+void testArena1()
+{
+    lpx_arena_t arena;
+    lpx_mempool_variable_t pool;
+    lpx_mempool_fixed_t fixedPool;
+    lpx_mempool_stats_t stats;
+    lpx_arena_t other;
+    lpx_arena_mark_t mark;
+    lpx_arena_mark_t foreign;
+
+    printf("=======================================\n");
+    assert(0 == lpx_arena_init(&arena, 1024));
+    arenaTest(&arena, 3000);
+    assert(0 == lpx_arena_destroy(&arena));
+    assert(NULL == lpx_arena_alloc(&arena, 10));
+
+    assert(0 == lpx_mempool_create_variable_pool(&pool, 1024 * 1024, 
+                                                 MEMPOOL_UNPROTECTED | MEMPOOL_STATS));
+    assert(0 == lpx_arena_init_from_pool(&arena, 4096, &pool));
+    arenaTest(&arena, 5000);
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.liveObjects == 1);
+    assert(0 == lpx_arena_destroy(&arena));
+    assert(0 == lpx_mempool_variable_get_stats(&pool, &stats));
+    assert(stats.liveObjects == 0);
+    assert(0 == lpx_mempool_destroy_variable_pool(&pool));
+
+    assert(0 == lpx_mempool_create_fixed_pool(&fixedPool, 4096, 64, MEMPOOL_UNPROTECTED | MEMPOOL_STATS));
+    assert(0 == lpx_arena_init_from_fixed_pool(&arena, &fixedPool));
+    arenaTest(&arena, 1000);
+
+    // A mark of another arena is refused and leaves every block in place.
+    assert(0 == lpx_arena_init_from_fixed_pool(&other, &fixedPool));
+    assert(0 == lpx_arena_mark(&other, &foreign));
+    assert(0 == lpx_arena_reset(&arena));
+    assert(NULL != lpx_arena_alloc(&arena, 3000));
+    assert(0 == lpx_arena_mark(&arena, &mark));
+    assert(NULL != lpx_arena_alloc(&arena, 3000));
+    assert(0 != lpx_arena_release_to_mark(&arena, &foreign));
+    assert(0 == lpx_mempool_fixed_get_stats(&fixedPool, &stats));
+    assert(stats.liveObjects == 3);
+    assert(NULL != lpx_arena_alloc(&arena, 1000));
+    assert(0 == lpx_arena_release_to_mark(&arena, &mark));
+    assert(0 == lpx_mempool_fixed_get_stats(&fixedPool, &stats));
+    assert(stats.liveObjects == 2);
+    assert(0 == lpx_arena_destroy(&other));
+    assert(NULL == lpx_arena_alloc(&arena, 8192));
+    assert(0 == lpx_arena_destroy(&arena));
+    assert(0 == lpx_mempool_destroy_fixed_pool(&fixedPool));
+
+    // Blocks of an aligned pool go back through lpx_mempool_aligned_free.
+    assert(0 == lpx_mempool_create_aligned_fixed_pool(&fixedPool, 4096, 64, 64,
+                                                      MEMPOOL_UNPROTECTED | MEMPOOL_STATS));
+    assert(0 == lpx_arena_init_from_fixed_pool(&arena, &fixedPool));
+    arenaTest(&arena, 1000);
+    assert(0 == lpx_arena_mark(&arena, &mark));
+    assert(NULL != lpx_arena_alloc(&arena, 3000));
+    assert(NULL != lpx_arena_alloc(&arena, 3000));
+    assert(0 == lpx_arena_release_to_mark(&arena, &mark));
+    assert(0 == lpx_arena_reset(&arena));
+    assert(0 == lpx_mempool_fixed_get_stats(&fixedPool, &stats));
+    assert(stats.liveObjects == 1);
+    assert(0 == lpx_arena_destroy(&arena));
+    assert(0 == lpx_mempool_fixed_get_stats(&fixedPool, &stats));
+    assert(stats.liveObjects == 0);
+    assert(0 == lpx_mempool_destroy_fixed_pool(&fixedPool));
+    printf("Test testArena1 passed.\n");
+}
+
 /**
  * @brief Run the battery of arraylist test without using memory pools.
  */
@@ -1092,6 +2676,12 @@ int main(int argc, char **argv)
     testSem1();
     testSem2();
     testSem3();
+    testSem4();
+    testSem5();
+    testSem6();
+    testSem7();
+    testRwlock1();
+    testDeadlines1();
     testThreadPool1();
     testThreadPool2();
     testThreadPool3();
@@ -1100,17 +2690,42 @@ int main(int argc, char **argv)
     testBarrier1();
     testFixedMemPool1();
     testFixedMemPool2();
+    testFixedMemPool3();
+    testFixedMemPool4();
+    testFixedMemPool5();
+    testFixedMemPool6();
+    testFixedMemPool7();
+    testFixedMemPool8();
+    testFixedMemPool9();
+    testFixedMemPool10();
+    testFixedMemPool11();
     testVariableMemPool1();
     testVariableMemPool2();
+    testVariableMemPool3();
+    testVariableMemPool4();
+    testVariableMemPool5();
+    testVariableMemPool6();
+    testVariableMemPool7();
+    testVariableMemPool8();
+    testVariableMemPool9();
+    testVariableMemPool10();
+    testVariableMemPool11();
+    testVariableMemPool12();
+    testSharedMemPool1();
+    testSizedMemPool1();
+    testSizedMemPool2();
     testPoolsFromFixedPool();
     testPoolsFromVariablePool();
     testPcq1();
     testPcq2();
     testTimedPcq1();
     testTreemapWorstCaseWithPools();
+    testTreemapWorstCaseWithSizedPools();
     testTreemapWorstCaseNoPools();
     testArraylistNoPools();
     testArraylistPools(); 
+    testArraylistSizedPools();
+    testArena1();
     return 0;
 }
 
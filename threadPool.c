@@ -339,7 +339,7 @@ int addNewWorker(lpx_threadpool_t *pool)
     if (runnable == NULL) { return THREAD_POOL_FAILURE; }
 
     /* Initialize the semaphore and set it to locked so that the thread can wait */
-    if (0 != lpx_sem_init(&runnable->workAvailable, 1)) { goto destroy_thread1; }
+    if (0 != lpx_sem_init_adaptive(&runnable->workAvailable, 1)) { goto destroy_thread1; }
     if (0 != lpx_sem_down(&runnable->workAvailable)) { goto destroy_thread2; }
 
     /* Acquire the lock and grow the thread pool. */
@@ -30,19 +30,26 @@
 
 /**
  * @def ALLOC
- * @brief A wrapper around the pool alloc and regular malloc.
+ * @brief A wrapper around the pool allocs and regular malloc.
  */
-#define ALLOC(pool,size) (((pool) == NULL)? malloc((size)) : lpx_mempool_variable_alloc((pool), (size)))
+#define ALLOC(treemap,size) (((treemap)->sizedPool != NULL) ? \
+                             lpx_mempool_sized_alloc((treemap)->sizedPool, (size)) : \
+                             ((treemap)->pool == NULL) ? malloc((size)) : \
+                             lpx_mempool_variable_alloc((treemap)->pool, (size)))
 
 /**
  * @def FREE
- * @brief A wrapper around the pool free or regular free.
+ * @brief A wrapper around the pool frees or regular free.
  */
-#define FREE(pool,ptr) (((pool) == NULL) ? free((ptr)) : lpx_mempool_variable_free((ptr)))
+#define FREE(treemap,ptr) (((treemap)->sizedPool != NULL) ? \
+                           (void)lpx_mempool_sized_free((treemap)->sizedPool, (ptr)) : \
+                           ((treemap)->pool == NULL) ? free((ptr)) : \
+                           (void)lpx_mempool_variable_free((ptr)))
 
 #define PRINT_PATH	0
 
-static int init(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t *pool);
+static int init(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t *pool,
+                lpx_mempool_sized_t *sizedPool);
 static rbnode *newNode(lpx_treemap_t *treemap, long key, long value);
 static inline int isRed(rbnode *node);
 static inline int isBlack(rbnode *node);
@@ -69,25 +76,28 @@ static int default_comparator(unsigned long v1, unsigned long v2);
  * @param treemap The treemap to initialize.
  * @param isProtected Should a rwlock be created for this treemap?
  * @param pool The pool to use, null if there is none.
+ * @param sizedPool The sized pool to use, null if there is none.
  * @return 0 on success, -1 on failure.
  */
-static int init(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t *pool)
+static int init(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t *pool,
+                lpx_mempool_sized_t *sizedPool)
 {
     if (treemap == NULL) {
         return TREEMAP_ERROR;
     }
 
     treemap->pool = pool;
+    treemap->sizedPool = sizedPool;
 
     // Set up the reader writer lock if it is protected.
     if (isProtected == TREEMAP_PROTECTED) {
-        treemap->rwlock = ALLOC(pool, sizeof(lpx_rwlock_t));
+        treemap->rwlock = ALLOC(treemap, sizeof(lpx_rwlock_t));
 	if (treemap->rwlock == NULL) {
 	    return TREEMAP_ERROR;
 	}
 
         if (0 != lpx_rwlock_init(treemap->rwlock)) {
-	    FREE(treemap->pool, treemap->rwlock);
+	    FREE(treemap, treemap->rwlock);
 	    return TREEMAP_ERROR;
 	}
     } else {
@@ -108,7 +118,7 @@ static int init(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t
  */
 int lpx_treemap_init(lpx_treemap_t *treemap, int isProtected)
 {
-    return init(treemap, isProtected, NULL);
+    return init(treemap, isProtected, NULL, NULL);
 }
 
 /**
@@ -121,7 +131,25 @@ int lpx_treemap_init(lpx_treemap_t *treemap, int isProtected)
 int lpx_treemap_init_from_pool(lpx_treemap_t *treemap, int isProtected, 
                                lpx_mempool_variable_t *pool)
 {
-    return init(treemap, isProtected, pool);
+    return init(treemap, isProtected, pool, NULL);
+}
+
+/**
+ * @brief  Initialize the treemap to allocate its nodes from a sized pool, which serves
+ *         them from a fixed pool of the right size class in constant time.
+ * @param  treemap The treemap to initalize.
+ * @param  isProtected Should this treemap be protected?
+ * @param  pool The sized pool to use.
+ * @return 0 on success, -1 on failure.
+ */
+int lpx_treemap_init_from_sized_pool(lpx_treemap_t *treemap, int isProtected, 
+                                     lpx_mempool_sized_t *pool)
+{
+    if (pool == NULL) {
+        return TREEMAP_ERROR;
+    }
+
+    return init(treemap, isProtected, NULL, pool);
 }
 
 /**
@@ -133,7 +161,7 @@ int lpx_treemap_init_from_pool(lpx_treemap_t *treemap, int isProtected,
  */
 static rbnode *newNode(lpx_treemap_t *treemap, long key, long value)
 {
-    rbnode *node = ALLOC(treemap->pool, sizeof(rbnode));
+    rbnode *node = ALLOC(treemap, sizeof(rbnode));
     if (node != NULL) {
         node->color = COLOR_RED;
 	node->left = NULL;
@@ -229,7 +257,7 @@ static int insert(lpx_treemap_t *treemap, long key, long value)
 	// Replace the current value, deallocate the new node & exit.
 	if (comp == 0) {
 	    currentNode->value = value;
-	    FREE(treemap->pool, node);
+	    FREE(treemap, node);
 	    return TREEMAP_SUCCESS;
 	}
     }
@@ -852,7 +880,7 @@ static int delete(lpx_treemap_t *treemap, rbnode *node)
     // Finally free the candidate. If we had deleted a replacement candidate, we copy the
     // data of the replacement into the node that should have been deleted.
     rbnode *parent = candidate->parent;
-    FREE(treemap->pool, candidate);
+    FREE(treemap, candidate);
     if (node != candidate) {
         node->key = key;
 	node->value = value;
@@ -917,7 +945,7 @@ int lpx_treemap_destroy(lpx_treemap_t *treemap)
 	    parentNode->right = NULL;
 	}
 
-	FREE(treemap->pool, currentNode);
+	FREE(treemap, currentNode);
 	currentNode = parentNode;
     }
 
@@ -929,7 +957,7 @@ int lpx_treemap_destroy(lpx_treemap_t *treemap)
     // Finally get rid of the rwlock.
     if (treemap->rwlock != NULL) {
         lpx_rwlock_destroy(treemap->rwlock);
-        FREE(treemap->pool, treemap->rwlock);
+        FREE(treemap, treemap->rwlock);
     }
 
     return TREEMAP_SUCCESS;
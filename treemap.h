@@ -78,6 +78,7 @@ typedef struct __rbnode {
 typedef struct __lpx_treemap_t {
     lpx_rwlock_t *rwlock;		/**< Mutex to protect the data structure. */
     lpx_mempool_variable_t *pool;       /**< The pool to allocate from. */
+    lpx_mempool_sized_t *sizedPool;     /**< The sized pool to allocate from, if not pool. */
     rbnode *head;                       /**< Pointer to the root node of the tree. */
     int (*comparator)(unsigned long, unsigned long); /**< An optional comparator. */
 } lpx_treemap_t;
@@ -86,6 +87,8 @@ int lpx_treemap_init(lpx_treemap_t *treemap, int isProtected);
 
 int lpx_treemap_init_from_pool(lpx_treemap_t *treemap, int isProtected, lpx_mempool_variable_t *pool);
 
+int lpx_treemap_init_from_sized_pool(lpx_treemap_t *treemap, int isProtected, lpx_mempool_sized_t *pool);
+
 int lpx_treemap_put(lpx_treemap_t *treemap, unsigned long key, unsigned long value);
 
 int lpx_treemap_get(lpx_treemap_t *treemap, unsigned long key, unsigned long *value);